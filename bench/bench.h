@@ -0,0 +1,98 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/**
+ * @brief Tiny benchmark harness shared by the C and the C++ benchmarks.
+ *
+ * A benchmark times the same piece of work `samples` times (after a few untimed warmup runs),
+ * and bench_report() prints one JSON object per benchmark with the mean, p50, p99 and min of the samples,
+ * plus the peak resident memory of the process so far.
+ * All times are in nanoseconds per sample, `items` says how many items (nodes, steps, ...) a sample covers.
+ *
+ * Output of a whole run:
+ * {"engine": "...", "compiler": "...", "benchmarks": [ {...}, {...} ]}
+ */
+
+static int bench_count = 0;
+
+/**
+ * @brief Monotonic wall clock, in nanoseconds.
+ */
+static double bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * @brief Peak resident set size of the process so far, in kilobytes.
+ * It only ever grows, so a benchmark reports the high-water mark of everything that ran before it as well.
+ */
+static long bench_peak_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static int bench_compare(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Opens the JSON document for one engine.
+ *
+ * @param engine Name of the engine that is benchmarked, for ex. "c-micrograd".
+ */
+static void bench_begin(const char* engine) {
+#ifdef __VERSION__
+    const char* compiler = __VERSION__;
+#else
+    const char* compiler = "unknown";
+#endif
+    printf("{\n  \"engine\": \"%s\",\n  \"compiler\": \"%s\",\n  \"benchmarks\": [", engine, compiler);
+    bench_count = 0;
+}
+
+/**
+ * @brief Prints the statistics of one benchmark as a JSON object.
+ *
+ * @param name Name of the benchmark, for ex. "backward".
+ * @param config What was run, for ex. "nodes=1000" or "mlp=8-8-2,batch=1".
+ * @param items How many items one sample covers, ns_per_item is mean_ns / items.
+ * @param samples The timed samples in nanoseconds, sorted in place.
+ * @param n Number of samples.
+ */
+static void bench_report(const char* name, const char* config, long items, double* samples, int n) {
+    qsort(samples, n, sizeof(double), bench_compare);
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) {
+        sum += samples[i];
+    }
+    double mean = sum / n;
+    double p50 = samples[n / 2];
+    double p99 = samples[(int)(0.99 * (n - 1))];
+
+    printf("%s\n    {\"name\": \"%s\", \"config\": \"%s\", \"items\": %ld, \"samples\": %d, "
+           "\"mean_ns\": %.1f, \"p50_ns\": %.1f, \"p99_ns\": %.1f, \"min_ns\": %.1f, "
+           "\"ns_per_item\": %.3f, \"peak_rss_kb\": %ld}",
+           bench_count ? "," : "", name, config, items, n,
+           mean, p50, p99, samples[0], mean / items, bench_peak_rss_kb());
+    fflush(stdout);
+    bench_count++;
+}
+
+/**
+ * @brief Closes the JSON document opened by bench_begin().
+ */
+static void bench_end(void) {
+    printf("\n  ]\n}\n");
+}
+
+#endif
@@ -0,0 +1,258 @@
+#include "../c-micrograd/mlp.h"
+#include "bench.h"
+
+/**
+ * @brief Benchmarks for c-micrograd, see bench.h for the output format.
+ *
+ * Note: backward() in engine.h sorts the graph into fixed arrays of 1000 nodes,
+ * so the graph sizes and MLPs below are kept under that.
+ */
+
+#define SAMPLES 200
+#define WARMUP 10
+#define MAX_GRAPH 1000
+
+/**
+ * @brief Frees every node of the graph under root, except the ones in keep (the parameters).
+ */
+void free_graph(Value* root, Value** keep, int n_keep) {
+    Value* topo[MAX_GRAPH];
+    int topo_size = 0;
+    Value* visited[MAX_GRAPH];
+    int visited_size = 0;
+    build_topo(root, topo, &topo_size, visited, &visited_size);
+    for (int i = 0; i < topo_size; i++) {
+        int kept = 0;
+        for (int j = 0; j < n_keep && !kept; j++) {
+            kept = (topo[i] == keep[j]);
+        }
+        if (!kept) {
+            free_value(topo[i]);
+        }
+    }
+}
+
+/**
+ * @brief Creation rate of add nodes, in a chain of `count` nodes per sample.
+ */
+void bench_node_creation(int count) {
+    double samples[SAMPLES];
+    Value** nodes = (Value**)malloc(count * sizeof(Value*));
+    Value* one = make_value(1.0);
+    for (int s = -WARMUP; s < SAMPLES; s++) {
+        double start = bench_now_ns();
+        Value* v = one;
+        for (int i = 0; i < count; i++) {
+            v = add(v, one);
+            nodes[i] = v;
+        }
+        double end = bench_now_ns();
+        for (int i = 0; i < count; i++) {
+            free_value(nodes[i]);
+        }
+        if (s >= 0) {
+            samples[s] = end - start;
+        }
+    }
+    char config[64];
+    snprintf(config, sizeof(config), "nodes=%d", count);
+    bench_report("node_creation", config, count, samples, SAMPLES);
+    free_value(one);
+    free(nodes);
+}
+
+/**
+ * @brief backward() on a graph of about `count` nodes, built once: a chain of adds and muls over fresh leaves.
+ */
+void bench_backward(int count) {
+    double samples[SAMPLES];
+    Value* root = make_value(1.0);
+    for (int i = 0; i + 2 < count; i += 2) {
+        Value* leaf = make_value(0.5 + (i % 7) * 0.1);
+        root = (i % 4) ? add(root, leaf) : mul(root, leaf);
+    }
+    for (int s = -WARMUP; s < SAMPLES; s++) {
+        double start = bench_now_ns();
+        root->grad = 1.0;
+        backward(root);
+        double end = bench_now_ns();
+        if (s >= 0) {
+            samples[s] = end - start;
+        }
+    }
+    char config[64];
+    snprintf(config, sizeof(config), "nodes=%d", count);
+    bench_report("backward", config, count, samples, SAMPLES);
+    free_graph(root, NULL, 0);
+}
+
+/**
+ * @brief All weights and biases of the MLP, in one array of n_params Values.
+ */
+Value** collect_params(MLP* mlp, int* n_params) {
+    *n_params = 0;
+    for (int i = 0; i < mlp->nlayers; i++) {
+        *n_params += mlp->layers[i]->nout * (mlp->layers[i]->neurons[0]->nin + 1);
+    }
+    Value** params = (Value**)malloc(*n_params * sizeof(Value*));
+    int p = 0;
+    for (int i = 0; i < mlp->nlayers; i++) {
+        for (int j = 0; j < mlp->layers[i]->nout; j++) {
+            Neuron* neuron = mlp->layers[i]->neurons[j];
+            for (int k = 0; k < neuron->nin; k++) {
+                params[p++] = neuron->w[k];
+            }
+            params[p++] = neuron->b;
+        }
+    }
+    return params;
+}
+
+/**
+ * @brief One training step of an MLP on a single example: forward, mse_loss, backward and the update.
+ * The MLP has `width` inputs, `depth` hidden layers of `width` neurons and 2 outputs.
+ */
+void bench_mlp_step(int width, int depth) {
+    double samples[SAMPLES];
+    int sizes[16];
+    int nlayers = depth + 2;
+    sizes[0] = width;
+    for (int i = 1; i <= depth; i++) {
+        sizes[i] = width;
+    }
+    sizes[depth + 1] = 2;
+    MLP* mlp = init_mlp(sizes, nlayers);
+
+    int n_params;
+    Value** params = collect_params(mlp, &n_params);
+
+    float* arr_x = (float*)malloc(width * sizeof(float));
+    for (int i = 0; i < width; i++) {
+        arr_x[i] = (rand() % 2000 - 1000) / 1000.0;
+    }
+    float arr_y[] = {1.0, 0.0};
+
+    for (int s = -WARMUP; s < SAMPLES; s++) {
+        Value** x = make_values(arr_x, width);
+        Value** y_true = make_values(arr_y, 2);
+
+        double start = bench_now_ns();
+        Value** y_pred = mlp_forward(mlp, x);
+        Value* loss = mse_loss(y_pred, y_true, 2);
+        for (int i = 0; i < n_params; i++) {
+            params[i]->grad = 0.0;
+        }
+        loss->grad = 1.0;
+        backward(loss);
+        for (int i = 0; i < n_params; i++) {
+            update_weights(params[i], 0.001);
+        }
+        double end = bench_now_ns();
+
+        free_graph(loss, params, n_params);
+        free(x);
+        free(y_true);
+        if (s >= 0) {
+            samples[s] = end - start;
+        }
+    }
+
+    char config[64];
+    int len = snprintf(config, sizeof(config), "mlp=%d", sizes[0]);
+    for (int i = 1; i < nlayers; i++) {
+        len += snprintf(config + len, sizeof(config) - len, "-%d", sizes[i]);
+    }
+    snprintf(config + len, sizeof(config) - len, ",batch=1");
+    bench_report("mlp_step", config, 1, samples, SAMPLES);
+
+    free(arr_x);
+    free(params);
+    free_mlp(mlp);
+}
+
+/**
+ * @brief Forward pass only, of the same MLPs as bench_mlp_step, two ways:
+ * graph is mlp_forward() on Value nodes, frozen is frozen_forward() on the MLP exported by freeze_mlp().
+ */
+void bench_inference(int width, int depth) {
+    double samples[SAMPLES];
+    int sizes[16];
+    int nlayers = depth + 2;
+    sizes[0] = width;
+    for (int i = 1; i <= depth; i++) {
+        sizes[i] = width;
+    }
+    sizes[depth + 1] = 2;
+    MLP* mlp = init_mlp(sizes, nlayers);
+    FrozenMLP* frozen = freeze_mlp(mlp);
+    int n_params;
+    Value** params = collect_params(mlp, &n_params);
+
+    float* arr_x = (float*)malloc(width * sizeof(float));
+    for (int i = 0; i < width; i++) {
+        arr_x[i] = (rand() % 2000 - 1000) / 1000.0;
+    }
+    float out[2];
+
+    char config[64];
+    int len = snprintf(config, sizeof(config), "mlp=%d", sizes[0]);
+    for (int i = 1; i < nlayers; i++) {
+        len += snprintf(config + len, sizeof(config) - len, "-%d", sizes[i]);
+    }
+    snprintf(config + len, sizeof(config) - len, ",batch=1");
+    char mode_config[80];
+
+    for (int s = -WARMUP; s < SAMPLES; s++) {
+        Value** x = make_values(arr_x, width);
+        double start = bench_now_ns();
+        Value** y_pred = mlp_forward(mlp, x);
+        double end = bench_now_ns();
+        // The outputs are not joined under one root, so tie them together to free the whole graph.
+        Value* root = add(y_pred[0], y_pred[1]);
+        free_graph(root, params, n_params);
+        free(x);
+        if (s >= 0) {
+            samples[s] = end - start;
+        }
+    }
+    snprintf(mode_config, sizeof(mode_config), "graph,%s", config);
+    bench_report("inference", mode_config, 1, samples, SAMPLES);
+
+    for (int s = -WARMUP; s < SAMPLES; s++) {
+        double start = bench_now_ns();
+        frozen_forward(frozen, arr_x, 1, out);
+        double end = bench_now_ns();
+        if (s >= 0) {
+            samples[s] = end - start;
+        }
+    }
+    snprintf(mode_config, sizeof(mode_config), "frozen,%s", config);
+    bench_report("inference", mode_config, 1, samples, SAMPLES);
+
+    free(arr_x);
+    free(params);
+    free_frozen_mlp(frozen);
+    free_mlp(mlp);
+}
+
+int main() {
+    srand(42);
+    bench_begin("c-micrograd");
+
+    bench_node_creation(100000);
+
+    int graph_sizes[] = {16, 64, 256, 900};
+    for (int i = 0; i < 4; i++) {
+        bench_backward(graph_sizes[i]);
+    }
+
+    // (width, depth) pairs whose step graph fits in MAX_GRAPH nodes.
+    int mlps[][2] = {{2, 1}, {4, 1}, {4, 2}, {8, 1}, {8, 2}};
+    for (int i = 0; i < 5; i++) {
+        bench_mlp_step(mlps[i][0], mlps[i][1]);
+        bench_inference(mlps[i][0], mlps[i][1]);
+    }
+
+    bench_end();
+    return 0;
+}
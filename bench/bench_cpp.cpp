@@ -0,0 +1,209 @@
+#include "../cpp-micrograd/engine.h"
+#include "../cpp-micrograd/gemm.h"
+#include "../cpp-micrograd/nn.h"
+#include "../cpp-micrograd/optim.h"
+#include "bench.h"
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Benchmarks for cpp-micrograd, see bench.h for the output format.
+ * The graph sizes and MLPs include the ones of bench_c.c, so the two engines can be compared line by line.
+ */
+
+static const int SAMPLES = 200;
+static const int WARMUP = 10;
+
+/**
+ * @brief Creation rate of add nodes, in a chain of `count` nodes per sample.
+ */
+void bench_node_creation(int count) {
+    std::vector<double> samples(SAMPLES);
+    for (int s = -WARMUP; s < SAMPLES; ++s) {
+        GraphScope scope;
+        Value one(1.0);
+        double start = bench_now_ns();
+        Value v = one;
+        for (int i = 0; i < count; ++i) {
+            v = v + one;
+        }
+        double end = bench_now_ns();
+        if (s >= 0) {
+            samples[s] = end - start;
+        }
+    }
+    std::string config = "nodes=" + std::to_string(count);
+    bench_report("node_creation", config.c_str(), count, samples.data(), SAMPLES);
+}
+
+/**
+ * @brief backward() on a graph of about `count` nodes, built once: a chain of adds and muls over fresh leaves.
+ */
+void bench_backward(int count) {
+    std::vector<double> samples(SAMPLES);
+    GraphScope scope;
+    Value root(1.0);
+    for (int i = 0; i + 2 < count; i += 2) {
+        Value leaf(0.5 + (i % 7) * 0.1);
+        root = (i % 4) ? root + leaf : root * leaf;
+    }
+    for (int s = -WARMUP; s < SAMPLES; ++s) {
+        double start = bench_now_ns();
+        root.backward();
+        double end = bench_now_ns();
+        if (s >= 0) {
+            samples[s] = end - start;
+        }
+    }
+    std::string config = "nodes=" + std::to_string(count);
+    bench_report("backward", config.c_str(), count, samples.data(), SAMPLES);
+}
+
+/**
+ * @brief One training step of an MLP on a minibatch: forward, mean squared error, zero_grad, backward and the update.
+ * The MLP has `width` inputs, `depth` hidden layers of `width` neurons and 2 outputs.
+ * With batch 1 the input goes in as scalar Values, like in c-micrograd, otherwise as one [batch, width] matrix.
+ */
+void bench_mlp_step(int width, int depth, int batch) {
+    std::vector<double> samples(SAMPLES);
+    std::vector<int> nout(depth, width);
+    nout.push_back(2);
+    MLP mlp(width, nout);
+    Parameters params = mlp.parameters();
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-1.0, 1.0);
+    std::vector<float> x(batch * width);
+    for (auto& value: x) {
+        value = dis(gen);
+    }
+    std::vector<float> y(batch * 2);
+    for (int b = 0; b < batch; ++b) {
+        y[2 * b] = 1.0;
+    }
+
+    for (int s = -WARMUP; s < SAMPLES; ++s) {
+        GraphScope scope;
+        double start = bench_now_ns();
+        Value loss(0.0);
+        if (batch == 1) {
+            std::vector<Value> input(x.begin(), x.end());
+            loss = mse_loss(mlp(input), y);
+        } else {
+            loss = mse_loss(mlp(x, batch), y.data());
+        }
+        mlp.zero_grad();
+        loss.backward();
+        axpy(params.size(), -0.001, params.grad(), params.data());
+        double end = bench_now_ns();
+        if (s >= 0) {
+            samples[s] = end - start;
+        }
+    }
+
+    std::string config = "mlp=" + std::to_string(width);
+    for (int n: nout) {
+        config += "-" + std::to_string(n);
+    }
+    config += ",batch=" + std::to_string(batch);
+    bench_report("mlp_step", config.c_str(), batch, samples.data(), SAMPLES);
+}
+
+/**
+ * @brief Forward pass only, of the same MLPs as bench_mlp_step, three ways:
+ * graph builds the autograd graph like training does, predict is MLP::predict() and frozen is FrozenMLP::forward().
+ */
+void bench_inference(int width, int depth, int batch) {
+    std::vector<int> nout(depth, width);
+    nout.push_back(2);
+    MLP mlp(width, nout);
+    FrozenMLP frozen = mlp.freeze();
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dis(-1.0, 1.0);
+    std::vector<float> x(batch * width);
+    for (auto& value: x) {
+        value = dis(gen);
+    }
+    std::vector<float> out(batch * 2);
+
+    std::string config = "mlp=" + std::to_string(width);
+    for (int n: nout) {
+        config += "-" + std::to_string(n);
+    }
+    config += ",batch=" + std::to_string(batch);
+
+    for (const char* mode: {"graph", "predict", "frozen"}) {
+        std::vector<double> samples(SAMPLES);
+        for (int s = -WARMUP; s < SAMPLES; ++s) {
+            GraphScope scope;
+            double start = bench_now_ns();
+            if (mode[0] == 'g') {
+                mlp(x, batch);
+            } else if (mode[0] == 'p') {
+                mlp.predict(x.data(), batch, out.data());
+            } else {
+                frozen.forward(x.data(), batch, out.data());
+            }
+            double end = bench_now_ns();
+            if (s >= 0) {
+                samples[s] = end - start;
+            }
+        }
+        bench_report("inference", (std::string(mode) + "," + config).c_str(), batch, samples.data(), SAMPLES);
+    }
+}
+
+/**
+ * @brief One step() of each optimizer over `count` parameters.
+ */
+void bench_optimizer(int count) {
+    Parameters params(ParamStore::global().size(), count);
+    for (int i = 0; i < count; ++i) {
+        Value::parameter(0.5).set_grad(0.01);
+    }
+    SGD sgd(params, 0.01);
+    SGD momentum(params, 0.01, 0.9);
+    Adam adam(params);
+    AdamW adamw(params);
+    std::pair<const char*, Optimizer*> optimizers[] = {{"sgd", &sgd}, {"momentum", &momentum}, {"adam", &adam}, {"adamw", &adamw}};
+
+    for (auto& optimizer: optimizers) {
+        std::vector<double> samples(SAMPLES);
+        for (int s = -WARMUP; s < SAMPLES; ++s) {
+            double start = bench_now_ns();
+            optimizer.second->step();
+            double end = bench_now_ns();
+            if (s >= 0) {
+                samples[s] = end - start;
+            }
+        }
+        std::string config = std::string(optimizer.first) + ",params=" + std::to_string(count);
+        bench_report("optimizer_step", config.c_str(), count, samples.data(), SAMPLES);
+    }
+}
+
+int main() {
+    bench_begin("cpp-micrograd");
+
+    bench_node_creation(100000);
+
+    for (int count: {16, 64, 256, 900, 4096, 65536, 1 << 20}) {
+        bench_backward(count);
+    }
+
+    for (int width: {2, 4, 8, 32, 128}) {
+        for (int depth: {1, 2, 4}) {
+            for (int batch: {1, 32}) {
+                bench_mlp_step(width, depth, batch);
+                bench_inference(width, depth, batch);
+            }
+        }
+    }
+
+    bench_optimizer(1 << 20);
+
+    bench_end();
+    return 0;
+}
@@ -0,0 +1,174 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "frozen.h"
+
+/**
+ * @struct CheckpointHeader
+ * @brief The first bytes of a checkpoint file, the same format as cpp-micrograd's checkpoint.h.
+ *
+ * The header is followed by the nlayers + 1 layer sizes and the nlayers activations, as uint32_t
+ * (0 for none, 2 for leaky ReLU, the numbering of cpp-micrograd's Act), then by the weights and the optimizer state,
+ * as floats, each starting on a 64 byte boundary. The weights are laid out like FrozenMLP's:
+ * every layer as its transposed [nin, nout] weights followed by its nout biases.
+ * Everything is in the byte order of the machine that wrote the file.
+ *
+ * @param magic "MGRADCKP".
+ * @param version CHECKPOINT_VERSION.
+ * @param nlayers Number of layers.
+ * @param n_weights Number of weights and biases.
+ * @param n_state Number of floats of optimizer state, 0 if there is none (c-micrograd never writes any).
+ * @param weights_offset, state_offset Where the weights and the state start, in bytes from the start of the file.
+ */
+typedef struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nlayers;
+    uint64_t n_weights;
+    uint64_t n_state;
+    uint64_t weights_offset;
+    uint64_t state_offset;
+} CheckpointHeader;
+
+#define CHECKPOINT_VERSION 1
+#define ACT_NONE 0
+#define ACT_LEAKY_RELU 2
+
+/**
+ * @brief Write a FrozenMLP to a checkpoint file.
+ *
+ * @param model Pointer to the FrozenMLP.
+ * @param path Path of the file, replaced if it exists. It is written as path.tmp, synced to disk and renamed over path,
+ *             so path always holds a whole checkpoint and a model still mapping the old file keeps the old weights.
+ * @return 0 on success, -1 if the file could not be written.
+ *
+ * @example
+ * save_frozen_mlp(model, "model.ckpt");
+ */
+int save_frozen_mlp(FrozenMLP* model, const char* path) {
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "MGRADCKP", 8);
+    header.version = CHECKPOINT_VERSION;
+    header.nlayers = model->nlayers;
+    for (int l = 0; l < model->nlayers; l++) {
+        header.n_weights += (uint64_t)(model->sizes[l] + 1) * model->sizes[l + 1];
+    }
+    uint64_t shape_bytes = (2 * model->nlayers + 1) * sizeof(uint32_t);
+    header.weights_offset = (sizeof(header) + shape_bytes + 63) & ~(uint64_t)63;
+
+    size_t tmp_len = strlen(path) + sizeof(".tmp");
+    char* tmp = (char*)malloc(tmp_len);
+    if (tmp == NULL) {
+        perror("Failed to open checkpoint");
+        return -1;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+    FILE* fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        perror("Failed to open checkpoint");
+        free(tmp);
+        return -1;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    for (int l = 0; l <= model->nlayers; l++) {
+        uint32_t size = model->sizes[l];
+        ok = ok && fwrite(&size, sizeof(size), 1, fp) == 1;
+    }
+    for (int l = 0; l < model->nlayers; l++) {
+        uint32_t act = model->nonlin[l] ? ACT_LEAKY_RELU : ACT_NONE;
+        ok = ok && fwrite(&act, sizeof(act), 1, fp) == 1;
+    }
+    char zeros[64] = {0};
+    size_t padding = header.weights_offset - sizeof(header) - shape_bytes;
+    ok = ok && fwrite(zeros, 1, padding, fp) == padding;
+    ok = ok && fwrite(model->weights, sizeof(float), header.n_weights, fp) == header.n_weights;
+    ok = ok && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) {
+        perror("Failed to write checkpoint");
+        remove(tmp);
+    }
+    free(tmp);
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief Load a FrozenMLP from a checkpoint file, without copying its weights.
+ *
+ * The file is mapped into memory and the model's weights point straight into the mapping,
+ * so loading takes the same time whatever the size of the model, and the weights are only read from disk
+ * as frozen_forward() touches them. free_frozen_mlp() unmaps the file.
+ *
+ * @param path Path of the checkpoint file.
+ * @return Pointer to the FrozenMLP, or NULL if the file is missing, is not a checkpoint of this version,
+ * is truncated, or uses an activation other than leaky ReLU.
+ *
+ * @example
+ * FrozenMLP* model = load_frozen_mlp("model.ckpt");
+ * float x[] = {3.0};
+ * float y[2];
+ * frozen_forward(model, x, 1, y);
+ */
+FrozenMLP* load_frozen_mlp(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open checkpoint");
+        return NULL;
+    }
+    struct stat info;
+    void* mapping = MAP_FAILED;
+    size_t length = 0;
+    if (fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(CheckpointHeader)) {
+        length = info.st_size;
+        mapping = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Failed to map checkpoint %s\n", path);
+        return NULL;
+    }
+
+    const CheckpointHeader* header = (const CheckpointHeader*)mapping;
+    const uint32_t* shape = (const uint32_t*)(header + 1);
+    int valid = memcmp(header->magic, "MGRADCKP", 8) == 0
+        && header->version == CHECKPOINT_VERSION
+        && header->nlayers > 0
+        && sizeof(CheckpointHeader) + (2 * (uint64_t)header->nlayers + 1) * sizeof(uint32_t) <= length
+        && header->weights_offset % 64 == 0
+        && header->weights_offset >= sizeof(CheckpointHeader) + (2 * (uint64_t)header->nlayers + 1) * sizeof(uint32_t)
+        && header->weights_offset <= length
+        && header->n_weights <= (length - header->weights_offset) / sizeof(float);
+    uint64_t n_weights = 0;
+    for (uint32_t l = 0; valid && l < header->nlayers; l++) {
+        uint32_t act = shape[header->nlayers + 1 + l];
+        valid = (act == ACT_NONE || act == ACT_LEAKY_RELU);
+        n_weights += (uint64_t)(shape[l] + 1) * shape[l + 1];
+    }
+    if (!valid || n_weights != header->n_weights) {
+        fprintf(stderr, "Not a valid checkpoint: %s\n", path);
+        munmap(mapping, length);
+        return NULL;
+    }
+
+    int* sizes = (int*)malloc((header->nlayers + 1) * sizeof(int));
+    for (uint32_t l = 0; l <= header->nlayers; l++) {
+        sizes[l] = shape[l];
+    }
+    FrozenMLP* model = make_frozen_mlp(sizes, header->nlayers, (float*)((char*)mapping + header->weights_offset));
+    free(sizes);
+    for (uint32_t l = 0; l < header->nlayers; l++) {
+        model->nonlin[l] = shape[header->nlayers + 1 + l] == ACT_LEAKY_RELU;
+    }
+    model->mapping = mapping;
+    model->mapping_size = length;
+    return model;
+}
+
+#endif
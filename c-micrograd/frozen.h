@@ -0,0 +1,159 @@
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/**
+ * @struct FrozenMLP
+ * @brief A trained MLP frozen for inference: its weights as plain float matrices, and nothing else.
+ *
+ * There are no Value nodes, no gradients and no computation graph here, and this header does not depend on
+ * engine.h or mlp.h, so it can be embedded on its own. Get one from a trained MLP with freeze_mlp() (in mlp.h).
+ *
+ * @param nlayers Number of layers.
+ * @param sizes The nlayers + 1 layer sizes, the inputs first.
+ * @param nonlin Per layer, 1 if a leaky ReLU follows it.
+ * @param relu_alpha Slope of the leaky ReLU for negative inputs.
+ * @param weights Every layer in order: its weights stored transposed, as a [nin, nout] row-major matrix, then its nout biases.
+ * @param scratch Two buffers of the widest layer's size, for the activations in between layers.
+ * @param mapping When loaded with load_frozen_mlp() (checkpoint.h), the mapped file the weights point into, else NULL.
+ * @param mapping_size Size of the mapping in bytes.
+ */
+typedef struct FrozenMLP {
+    int nlayers;
+    int* sizes;
+    int* nonlin;
+    float relu_alpha;
+    float* weights;
+    float* scratch[2];
+    void* mapping;
+    size_t mapping_size;
+} FrozenMLP;
+
+/**
+ * @brief Allocate a FrozenMLP with the given layer sizes.
+ *
+ * The first nlayers - 1 layers get a leaky ReLU, the last one none, like in init_mlp().
+ *
+ * @param sizes Array of the nlayers + 1 layer sizes, the inputs first.
+ * @param nlayers Number of layers.
+ * @param weights The weights to use, or NULL to allocate them and leave them for the caller to fill in.
+ * @return Pointer to the new FrozenMLP.
+ *
+ * @example
+ * int sizes[] = {1, 5, 2};
+ * FrozenMLP* model = make_frozen_mlp(sizes, 2, NULL);
+ */
+FrozenMLP* make_frozen_mlp(int* sizes, int nlayers, float* weights) {
+    FrozenMLP* model = (FrozenMLP*)malloc(sizeof(FrozenMLP));
+    model->nlayers = nlayers;
+    model->sizes = (int*)malloc((nlayers + 1) * sizeof(int));
+    model->nonlin = (int*)malloc(nlayers * sizeof(int));
+    memcpy(model->sizes, sizes, (nlayers + 1) * sizeof(int));
+    model->relu_alpha = 0.01;
+
+    size_t n_weights = 0;
+    int widest = 0;
+    for (int l = 0; l < nlayers; l++) {
+        n_weights += (size_t)(sizes[l] + 1) * sizes[l + 1];
+        model->nonlin[l] = (l != nlayers - 1);
+        if (sizes[l + 1] > widest) {
+            widest = sizes[l + 1];
+        }
+    }
+    model->weights = weights ? weights : (float*)malloc(n_weights * sizeof(float));
+    model->mapping = NULL;
+    model->mapping_size = 0;
+    model->scratch[0] = (float*)malloc(widest * sizeof(float));
+    model->scratch[1] = (float*)malloc(widest * sizeof(float));
+    if (model->weights == NULL || model->scratch[0] == NULL || model->scratch[1] == NULL) {
+        perror("Memory allocation failed");
+        exit(1);
+    }
+    return model;
+}
+
+/**
+ * @brief Run a single example through a FrozenMLP.
+ *
+ * Every layer starts from its biases, then adds input i times row i of the transposed weights, for every input.
+ * The inner loop runs over the outputs on contiguous, non-aliasing arrays, so the compiler vectorizes it (build with -O3).
+ *
+ * @param model Pointer to the FrozenMLP.
+ * @param x Array of sizes[0] inputs.
+ * @param out Array of sizes[nlayers] floats receiving the outputs.
+ *
+ * @example
+ * float x[] = {3.0};
+ * float y[2];
+ * frozen_forward_one(model, x, y);
+ */
+void frozen_forward_one(FrozenMLP* model, const float* x, float* out) {
+    const float* in = x;
+    const float* w = model->weights;
+    for (int l = 0; l < model->nlayers; l++) {
+        int nin = model->sizes[l];
+        int nout = model->sizes[l + 1];
+        const float* bias = w + (size_t)nin * nout;
+        float* restrict dst = (l == model->nlayers - 1) ? out : model->scratch[l % 2];
+
+        memcpy(dst, bias, nout * sizeof(float));
+        for (int i = 0; i < nin; i++) {
+            float xi = in[i];
+            const float* restrict row = w + (size_t)i * nout;
+            for (int j = 0; j < nout; j++) {
+                dst[j] += xi * row[j];
+            }
+        }
+        if (model->nonlin[l]) {
+            for (int j = 0; j < nout; j++) {
+                dst[j] = dst[j] > 0 ? dst[j] : model->relu_alpha * dst[j];
+            }
+        }
+
+        in = dst;
+        w = bias + nout;
+    }
+}
+
+/**
+ * @brief Run a batch of examples through a FrozenMLP.
+ *
+ * @param model Pointer to the FrozenMLP.
+ * @param x Row-major [batch, sizes[0]] inputs.
+ * @param batch Number of examples.
+ * @param out Row-major [batch, sizes[nlayers]] outputs.
+ *
+ * @note
+ * The model's scratch buffers are used, so one FrozenMLP must not run on several threads at once.
+ */
+void frozen_forward(FrozenMLP* model, const float* x, int batch, float* out) {
+    int nin = model->sizes[0];
+    int nout = model->sizes[model->nlayers];
+    for (int b = 0; b < batch; b++) {
+        frozen_forward_one(model, x + (size_t)b * nin, out + (size_t)b * nout);
+    }
+}
+
+/**
+ * @brief Free the memory allocated for a FrozenMLP.
+ *
+ * @param model Pointer to the FrozenMLP to be freed.
+ */
+void free_frozen_mlp(FrozenMLP* model) {
+    free(model->sizes);
+    free(model->nonlin);
+    if (model->mapping == NULL) {
+        free(model->weights);
+    } else {
+        munmap(model->mapping, model->mapping_size);
+    }
+    free(model->scratch[0]);
+    free(model->scratch[1]);
+    free(model);
+}
+
+#endif
@@ -1,44 +1,253 @@
+#include <float.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#define MAX_ENTRIES 30
+#define READER_CHUNK (1 << 20)
+// Largest exponent parse_float() accepts, well past what a float can hold either way.
+#define MAX_EXPONENT 400
 
-typedef struct {
-    float number;
-    float label;  // 0 for even, 1 for odd
-} Entry;
+/**
+ * @struct DataReader
+ * @brief Streams a text or CSV dataset from disk in fixed-size batches.
+ *
+ * Every line of the file is one example of `ncols` numbers, separated by spaces, tabs or commas
+ * (for ex. `90 0` or `90,0`). Lines that do not start with a number, such as a CSV header or a `#` comment, are skipped.
+ * The file is read in chunks of `chunk_size` bytes and parsed in place, so memory use is bounded by
+ * the chunk and the batch, however large the file is.
+ *
+ * @param fp The open file.
+ * @param buffer The current chunk, `chunk_size` bytes plus a terminating 0.
+ * @param chunk_size Size of a chunk; also the longest line the reader accepts.
+ * @param start, end The bytes of buffer that are read but not parsed yet.
+ * @param eof 1 once the whole file has been read into buffer.
+ * @param ncols Numbers per line.
+ * @param batch_size Lines per batch.
+ * @param batch The current batch, a row-major [batch_size, ncols] array filled by read_batch().
+ */
+typedef struct DataReader {
+    FILE* fp;
+    char* buffer;
+    size_t chunk_size;
+    size_t start;
+    size_t end;
+    int eof;
+    int ncols;
+    int batch_size;
+    float* batch;
+} DataReader;
 
-Entry* load_data() {
-    FILE *fp;
-    Entry *entries = malloc(MAX_ENTRIES * sizeof(Entry));
-    if (entries == NULL) {
+/**
+ * @brief Open a dataset file for streaming.
+ *
+ * @param path Path of the text or CSV file.
+ * @param ncols Numbers per line.
+ * @param batch_size Lines per batch.
+ * @param chunk_size Bytes read from disk at a time, READER_CHUNK is a good default.
+ * @return Pointer to the DataReader.
+ *
+ * @example
+ * DataReader* reader = open_reader("data.txt", 2, 5, READER_CHUNK);  // batches of 5 (number, label) pairs
+ */
+DataReader* open_reader(const char* path, int ncols, int batch_size, size_t chunk_size) {
+    DataReader* reader = (DataReader*)malloc(sizeof(DataReader));
+    if (reader == NULL) {
         perror("Failed to allocate memory");
         exit(1);
     }
-    int count = 0;
-
-    fp = fopen("data.txt", "r");
-    if (fp == NULL) {
+    reader->fp = fopen(path, "rb");
+    if (reader->fp == NULL) {
         perror("Failed to open file");
-        free(entries);
+        free(reader);
         exit(1);
     }
+    reader->buffer = (char*)malloc(chunk_size + 1);
+    reader->batch = (float*)malloc((size_t)batch_size * ncols * sizeof(float));
+    if (reader->buffer == NULL || reader->batch == NULL) {
+        perror("Failed to allocate memory");
+        exit(1);
+    }
+    reader->chunk_size = chunk_size;
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = 0;
+    reader->ncols = ncols;
+    reader->batch_size = batch_size;
+    return reader;
+}
 
-    while (fscanf(fp, "%f %f", &entries[count].number, &entries[count].label) != EOF && count < MAX_ENTRIES) {
-        count++;
+/**
+ * @brief Move the unparsed tail of the buffer to its front and fill the rest from the file.
+ *
+ * @param reader Pointer to the DataReader.
+ * @return 1 if more bytes were read, 0 at the end of the file or if the buffer is already full.
+ */
+int refill_reader(DataReader* reader) {
+    size_t left = reader->end - reader->start;
+    memmove(reader->buffer, reader->buffer + reader->start, left);
+    reader->start = 0;
+    reader->end = left;
+    if (reader->eof || left == reader->chunk_size) {
+        return 0;
     }
-    fclose(fp);
+    size_t n = fread(reader->buffer + left, 1, reader->chunk_size - left, reader->fp);
+    reader->end += n;
+    reader->buffer[reader->end] = '\0';
+    if (n < reader->chunk_size - left) {
+        reader->eof = 1;
+    }
+    return n > 0;
+}
 
-    return entries;
+/**
+ * @brief Parse a decimal float, such as `42`, `-0.5` or `1e-3`, starting at s.
+ *
+ * A plain loop over the digits, much faster than strtof() or fscanf(), which go through the locale.
+ * Numbers with more than about 7 significant digits can come out 1 ulp off from strtof().
+ * A number too large for a float, or with an exponent beyond MAX_EXPONENT, is not a number either.
+ *
+ * @param s The text to parse.
+ * @param end Receives a pointer to the first character after the number, or s if there was none.
+ * @return The parsed value.
+ */
+float parse_float(const char* s, const char** end) {
+    const char* p = s;
+    int negative = 0;
+    if (*p == '-' || *p == '+') {
+        negative = (*p == '-');
+        p++;
+    }
+    const char* digits = p;
+    double value = 0.0;
+    while (*p >= '0' && *p <= '9') {
+        value = value * 10 + (*p++ - '0');
+    }
+    if (*p == '.') {
+        p++;
+        double scale = 0.1;
+        while (*p >= '0' && *p <= '9') {
+            value += (*p++ - '0') * scale;
+            scale *= 0.1;
+        }
+    }
+    if (p == digits || (p == digits + 1 && *digits == '.')) {
+        *end = s;
+        return 0.0;
+    }
+    if (*p == 'e' || *p == 'E') {
+        const char* q = p + 1;
+        int exp_negative = 0;
+        if (*q == '-' || *q == '+') {
+            exp_negative = (*q == '-');
+            q++;
+        }
+        if (*q >= '0' && *q <= '9') {
+            int exponent = 0;
+            while (*q >= '0' && *q <= '9') {
+                if (exponent <= MAX_EXPONENT) {
+                    exponent = exponent * 10 + (*q - '0');
+                }
+                q++;
+            }
+            if (exponent > MAX_EXPONENT) {
+                *end = s;
+                return 0.0;
+            }
+            double base = exp_negative ? 0.1 : 10.0;
+            while (exponent--) {
+                value *= base;
+            }
+            p = q;
+        }
+    }
+    if (value > FLT_MAX) {
+        *end = s;
+        return 0.0;
+    }
+    *end = p;
+    return negative ? -value : value;
 }
 
-// int main() {
-//     Entry* entries = load_data();
-    
-//     for (int i = 0; i < MAX_ENTRIES; i++) {
-//         printf("Number: %d, Label: %d\n", entries[i].number, entries[i].label);
-//     }
+/**
+ * @brief Read the next batch of examples into reader->batch.
+ *
+ * @param reader Pointer to the DataReader.
+ * @return Number of examples read: batch_size, fewer for the last batch of the file, and 0 once the file is exhausted.
+ *
+ * @example
+ * int rows;
+ * while ((rows = read_batch(reader)) > 0) {
+ *     for (int r = 0; r < rows; r++) {
+ *         float number = reader->batch[2 * r], label = reader->batch[2 * r + 1];
+ *     }
+ * }
+ */
+int read_batch(DataReader* reader) {
+    int rows = 0;
+    while (rows < reader->batch_size) {
+        char* line = reader->buffer + reader->start;
+        char* newline = (char*)memchr(line, '\n', reader->end - reader->start);
+        if (newline == NULL && !reader->eof) {
+            // The line goes on past the chunk, bring the rest of it in.
+            if (!refill_reader(reader) && !reader->eof) {
+                fprintf(stderr, "Line longer than the chunk size (%zu bytes)\n", reader->chunk_size);
+                exit(1);
+            }
+            continue;
+        }
+        if (newline == NULL && reader->start == reader->end) {
+            break;  // end of the file
+        }
+        char* line_end = newline ? newline : reader->buffer + reader->end;
+        *line_end = '\0';
+        reader->start = line_end - reader->buffer + (newline != NULL);
 
-//     free(entries);  // Remember to free the memory when done
-//     return 0;
-// }
+        const char* p = line;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        const char* end;
+        parse_float(p, &end);
+        if (end == p) {
+            continue;  // blank, header or comment line
+        }
+        float* row = reader->batch + (size_t)rows * reader->ncols;
+        for (int c = 0; c < reader->ncols; c++) {
+            while (*p == ' ' || *p == '\t' || *p == ',' || *p == '\r') {
+                p++;
+            }
+            row[c] = parse_float(p, &end);
+            if (end == p) {
+                fprintf(stderr, "Expected %d numbers on the line: %s\n", reader->ncols, line);
+                exit(1);
+            }
+            p = end;
+        }
+        rows++;
+    }
+    return rows;
+}
+
+/**
+ * @brief Go back to the start of the file, for ex. at the start of every epoch.
+ *
+ * @param reader Pointer to the DataReader.
+ */
+void rewind_reader(DataReader* reader) {
+    rewind(reader->fp);
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = 0;
+}
+
+/**
+ * @brief Close the file and free the memory allocated for a DataReader.
+ *
+ * @param reader Pointer to the DataReader to be freed.
+ */
+void close_reader(DataReader* reader) {
+    fclose(reader->fp);
+    free(reader->buffer);
+    free(reader->batch);
+    free(reader);
+}
@@ -0,0 +1,254 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @struct SpscQueue
+ * @brief A bounded single-producer single-consumer queue of ints, without locks.
+ *
+ * One thread may push and one other thread may pop, neither of them ever blocks.
+ * The producer only writes tail and the consumer only writes head, and the release/acquire pair on them
+ * hands over the item, and everything written before it, from one thread to the other.
+ *
+ * @param items capacity + 1 places, one is always kept empty to tell a full queue from an empty one.
+ * @param n Number of places.
+ * @param head Next item to pop.
+ * @param tail Next free place.
+ */
+typedef struct SpscQueue {
+    int* items;
+    int n;
+    _Atomic int head;
+    _Atomic int tail;
+} SpscQueue;
+
+void init_queue(SpscQueue* q, int capacity) {
+    q->items = (int*)malloc((capacity + 1) * sizeof(int));
+    q->n = capacity + 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+}
+
+/**
+ * @brief Add item at the tail of the queue.
+ * @return 1 on success, 0 if the queue is full.
+ */
+int queue_push(SpscQueue* q, int item) {
+    int t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    int next = (t + 1) % q->n;
+    if (next == atomic_load_explicit(&q->head, memory_order_acquire)) {
+        return 0;
+    }
+    q->items[t] = item;
+    atomic_store_explicit(&q->tail, next, memory_order_release);
+    return 1;
+}
+
+/**
+ * @brief Take the item at the head of the queue.
+ * @return 1 on success, 0 if the queue is empty.
+ */
+int queue_pop(SpscQueue* q, int* item) {
+    int h = atomic_load_explicit(&q->head, memory_order_relaxed);
+    if (h == atomic_load_explicit(&q->tail, memory_order_acquire)) {
+        return 0;
+    }
+    *item = q->items[h];
+    atomic_store_explicit(&q->head, (h + 1) % q->n, memory_order_release);
+    return 1;
+}
+
+/**
+ * @struct Batch
+ * @brief A minibatch handed out by a BatchLoader.
+ *
+ * @param x Row-major [rows, nin] inputs.
+ * @param y Row-major [rows, nout] targets.
+ * @param rows Number of examples, batch_size except maybe for the last batch of an epoch.
+ * @param epoch The epoch this batch belongs to, from 0.
+ */
+typedef struct Batch {
+    float* x;
+    float* y;
+    int rows;
+    int epoch;
+} Batch;
+
+/**
+ * @struct BatchLoader
+ * @brief Prepares shuffled minibatches on a background thread, ahead of the training loop.
+ *
+ * The dataset is `size` examples, with row-major [size, nin] inputs and [size, nout] targets, and is not copied.
+ * Every epoch the producer thread shuffles the order of the examples and gathers them batch_size at a time
+ * into one of prefetch + 1 preallocated slots. The slots go round between the two threads through two SpscQueues:
+ * ready ones to the trainer, used ones back to the producer. So there is no allocation and no lock while training,
+ * and as long as preparing a batch is faster than training on one, next_batch() never waits.
+ */
+typedef struct BatchLoader {
+    const float* x;
+    const float* y;
+    int size;
+    int nin;
+    int nout;
+    int batch_size;
+    int epochs;
+    unsigned int seed;
+    int* order;
+    float* slots;
+    Batch* batches;
+    SpscQueue ready;
+    SpscQueue recycled;
+    int current;
+    int finished;
+    atomic_int stopping;
+    pthread_t producer;
+} BatchLoader;
+
+void* produce_batches(void* arg) {
+    BatchLoader* loader = (BatchLoader*)arg;
+    int slot_size = loader->batch_size * (loader->nin + loader->nout);
+    for (int i = 0; i < loader->size; i++) {
+        loader->order[i] = i;
+    }
+    for (int epoch = 0; loader->size > 0 && epoch < loader->epochs; epoch++) {
+        // Fisher-Yates shuffle, with rand_r() so the global rand() of the training thread is left alone.
+        for (int i = loader->size - 1; i > 0; i--) {
+            int j = rand_r(&loader->seed) % (i + 1);
+            int tmp = loader->order[i];
+            loader->order[i] = loader->order[j];
+            loader->order[j] = tmp;
+        }
+        for (int start = 0; start < loader->size; start += loader->batch_size) {
+            int slot;
+            while (!queue_pop(&loader->recycled, &slot)) {
+                if (atomic_load_explicit(&loader->stopping, memory_order_relaxed)) {
+                    return NULL;
+                }
+                sched_yield();
+            }
+
+            int rows = loader->size - start < loader->batch_size ? loader->size - start : loader->batch_size;
+            float* bx = loader->slots + (size_t)slot * slot_size;
+            float* by = bx + loader->batch_size * loader->nin;
+            for (int r = 0; r < rows; r++) {
+                int example = loader->order[start + r];
+                memcpy(bx + r * loader->nin, loader->x + (size_t)example * loader->nin, loader->nin * sizeof(float));
+                memcpy(by + r * loader->nout, loader->y + (size_t)example * loader->nout, loader->nout * sizeof(float));
+            }
+            loader->batches[slot].x = bx;
+            loader->batches[slot].y = by;
+            loader->batches[slot].rows = rows;
+            loader->batches[slot].epoch = epoch;
+            queue_push(&loader->ready, slot);
+        }
+    }
+    // No more batches, ready has room for every slot plus this.
+    queue_push(&loader->ready, -1);
+    return NULL;
+}
+
+/**
+ * @brief Start a BatchLoader, its background thread begins preparing batches right away.
+ *
+ * @param x Row-major [size, nin] inputs.
+ * @param y Row-major [size, nout] targets.
+ * @param size Number of examples.
+ * @param nin, nout Inputs and targets per example.
+ * @param batch_size Examples per batch.
+ * @param epochs Passes over the dataset.
+ * @param seed Seed of the shuffles.
+ * @param prefetch How many batches may be ready and waiting at once.
+ * @return Pointer to the BatchLoader.
+ *
+ * @example
+ * BatchLoader* loader = start_loader(x, y, 25, 1, 2, 2, 50, 43, 2);
+ * Batch* batch;
+ * while ((batch = next_batch(loader)) != NULL) {
+ *     // train on batch->rows examples
+ * }
+ * stop_loader(loader);
+ */
+BatchLoader* start_loader(const float* x, const float* y, int size, int nin, int nout, int batch_size, int epochs,
+                          unsigned int seed, int prefetch) {
+    BatchLoader* loader = (BatchLoader*)malloc(sizeof(BatchLoader));
+    loader->x = x;
+    loader->y = y;
+    loader->size = size;
+    loader->nin = nin;
+    loader->nout = nout;
+    loader->batch_size = batch_size;
+    loader->epochs = epochs;
+    loader->seed = seed;
+    loader->order = (int*)malloc(size * sizeof(int));
+    loader->slots = (float*)malloc((size_t)(prefetch + 1) * batch_size * (nin + nout) * sizeof(float));
+    loader->batches = (Batch*)malloc((prefetch + 1) * sizeof(Batch));
+    if (loader->order == NULL || loader->slots == NULL || loader->batches == NULL) {
+        perror("Memory allocation failed");
+        exit(1);
+    }
+    init_queue(&loader->ready, prefetch + 2);
+    init_queue(&loader->recycled, prefetch + 1);
+    for (int slot = 0; slot <= prefetch; slot++) {
+        queue_push(&loader->recycled, slot);
+    }
+    loader->current = -1;
+    loader->finished = 0;
+    atomic_init(&loader->stopping, 0);
+    if (pthread_create(&loader->producer, NULL, produce_batches, loader) != 0) {
+        perror("Failed to start the loader thread");
+        exit(1);
+    }
+    return loader;
+}
+
+/**
+ * @brief The next minibatch, or NULL once all epochs are done.
+ *
+ * The batch stays valid until the following call, which hands its slot back to the producer.
+ *
+ * @param loader Pointer to the BatchLoader.
+ * @return Pointer to the Batch.
+ */
+Batch* next_batch(BatchLoader* loader) {
+    if (loader->current >= 0) {
+        queue_push(&loader->recycled, loader->current);
+        loader->current = -1;
+    }
+    if (loader->finished) {
+        return NULL;
+    }
+    int slot;
+    while (!queue_pop(&loader->ready, &slot)) {
+        sched_yield();
+    }
+    if (slot < 0) {
+        loader->finished = 1;
+        return NULL;
+    }
+    loader->current = slot;
+    return &loader->batches[slot];
+}
+
+/**
+ * @brief Stop the background thread, also before all epochs are done, and free the BatchLoader.
+ *
+ * @param loader Pointer to the BatchLoader to be freed.
+ */
+void stop_loader(BatchLoader* loader) {
+    atomic_store_explicit(&loader->stopping, 1, memory_order_relaxed);
+    pthread_join(loader->producer, NULL);
+    free(loader->order);
+    free(loader->slots);
+    free(loader->batches);
+    free(loader->ready.items);
+    free(loader->recycled.items);
+    free(loader);
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "engine.h"
+#include "checkpoint.h"
 #include <time.h>
 
 
@@ -170,9 +171,40 @@ Value** mlp_forward(MLP* mlp, Value** x) {
     return x;
 }
 
+/**
+ * @brief Backward function for the fused mean squared error.
+ *
+ * Computes the gradient of the MSE loss with respect to every prediction (and target) in one pass.
+ *
+ * @param v Pointer to the Value object resulting from mse_loss.
+ *
+ * @note
+ * The children of v are the `size` predictions followed by the `size` targets.
+ * The loss is L = sum_i (p_i - t_i)^2 / size, so the local derivatives are:
+ *     dL/dp_i (locally) = 2 * (p_i - t_i) / size
+ *     dL/dt_i (locally) = -2 * (p_i - t_i) / size
+ * The external gradient (from parent nodes) is stored in v->grad.
+ */
+void mse_backward(Value* v) {
+    int size = v->n_children / 2;
+    for (int i = 0; i < size; i++) {
+        Value* pred = v->children[i];
+        Value* target = v->children[size + i];
+        float g = 2 * (pred->val - target->val) / size * v->grad;
+        pred->grad += g;
+        target->grad -= g;
+        grad_clip(pred, -10.0, 10.0);
+        grad_clip(target, -10.0, 10.0);
+    }
+}
+
 /**
  * @brief Compute the mean squared error (MSE) loss between predicted and true values.
  *
+ * The loss is a single node, with the predictions and the true values as its children,
+ * instead of a sub, a power and an add node (and a constant) per value plus a final division.
+ * Its backward (mse_backward) is computed in closed form.
+ *
  * @param y_pred Array of predicted values.
  * @param y_true Array of true values.
  * @param size Number of values in y_pred and y_true arrays.
@@ -184,16 +216,21 @@ Value** mlp_forward(MLP* mlp, Value** x) {
  * Value* loss = mse_loss(predicted, true_values, 2);
  */
 Value* mse_loss(Value** y_pred, Value** y_true, int size) {
-    
-    Value* loss = make_value(0.0);
+    Value* out = (Value*)malloc(sizeof(Value));
+    out->children = (Value**)malloc(2 * size * sizeof(Value*));
+    float sum = 0.0;
     for (int i = 0; i < size; i++) {
-        Value* diff = sub(y_pred[i], y_true[i]);
-        Value* sq = power(diff, make_value(2.0));
-        loss = add(loss, sq);
+        float diff = y_pred[i]->val - y_true[i]->val;
+        sum += diff * diff;
+        out->children[i] = y_pred[i];
+        out->children[size + i] = y_true[i];
     }
-    loss = divide(loss, make_value(size));
+    out->val = sum / size;
+    out->grad = 0;
+    out->n_children = 2 * size;
+    out->backward = mse_backward;
 
-    return loss;
+    return out;
 }
 
 /**
@@ -274,6 +311,112 @@ Value* train(MLP* mlp, Value** x, Value** y_true, float lr) {
     // free_value(loss);
 }
 
+/**
+ * @brief Export a trained MLP to a FrozenMLP, for inference only.
+ *
+ * The weights are copied out of the Value nodes into one flat array, each layer's weights transposed
+ * to a [nin, nout] matrix followed by its biases, so the MLP can be freed (or trained further) independently.
+ *
+ * @param mlp Pointer to the trained MLP.
+ * @return Pointer to the new FrozenMLP.
+ *
+ * @example
+ * FrozenMLP* model = freeze_mlp(my_mlp);
+ * float x[] = {3.0};
+ * float y[2];
+ * frozen_forward(model, x, 1, y);
+ */
+FrozenMLP* freeze_mlp(MLP* mlp) {
+    int* sizes = (int*)malloc((mlp->nlayers + 1) * sizeof(int));
+    sizes[0] = mlp->layers[0]->neurons[0]->nin;
+    for (int l = 0; l < mlp->nlayers; l++) {
+        sizes[l + 1] = mlp->layers[l]->nout;
+    }
+    FrozenMLP* model = make_frozen_mlp(sizes, mlp->nlayers, NULL);
+    model->relu_alpha = relu_alpha;
+    free(sizes);
+
+    float* w = model->weights;
+    for (int l = 0; l < mlp->nlayers; l++) {
+        Layer* layer = mlp->layers[l];
+        int nin = layer->neurons[0]->nin;
+        for (int i = 0; i < nin; i++) {
+            for (int j = 0; j < layer->nout; j++) {
+                *w++ = layer->neurons[j]->w[i]->val;
+            }
+        }
+        for (int j = 0; j < layer->nout; j++) {
+            *w++ = layer->neurons[j]->b->val;
+            model->nonlin[l] = layer->neurons[j]->nonlin;
+        }
+    }
+    return model;
+}
+
+/**
+ * @brief Save the weights and biases of the MLP to a checkpoint file (see checkpoint.h).
+ *
+ * The file can be served as is with load_frozen_mlp(), and loaded by cpp-micrograd's MLP::load() as well.
+ *
+ * @param mlp Pointer to the MLP.
+ * @param path Path of the file.
+ * @return 0 on success, -1 if the file could not be written.
+ *
+ * @example
+ * save_mlp(my_mlp, "model.ckpt");
+ */
+int save_mlp(MLP* mlp, const char* path) {
+    FrozenMLP* model = freeze_mlp(mlp);
+    int result = save_frozen_mlp(model, path);
+    free_frozen_mlp(model);
+    return result;
+}
+
+/**
+ * @brief Load the weights and biases of the MLP from a checkpoint file.
+ *
+ * The file is mapped rather than read, and its values copied straight into the MLP's Values.
+ *
+ * @param mlp Pointer to an MLP with the same layer sizes as the saved one.
+ * @param path Path of the checkpoint file.
+ * @return 0 on success, -1 if the file is not a valid checkpoint or holds a network of another shape.
+ *
+ * @example
+ * MLP* my_mlp = init_mlp(sizes, nlayers);
+ * load_mlp(my_mlp, "model.ckpt");
+ */
+int load_mlp(MLP* mlp, const char* path) {
+    FrozenMLP* model = load_frozen_mlp(path);
+    if (model == NULL) {
+        return -1;
+    }
+    int matches = model->nlayers == mlp->nlayers && model->sizes[0] == mlp->layers[0]->neurons[0]->nin;
+    for (int l = 0; matches && l < mlp->nlayers; l++) {
+        matches = model->sizes[l + 1] == mlp->layers[l]->nout && model->nonlin[l] == mlp->layers[l]->neurons[0]->nonlin;
+    }
+    if (!matches) {
+        fprintf(stderr, "Checkpoint %s holds a network of another shape\n", path);
+        free_frozen_mlp(model);
+        return -1;
+    }
+
+    const float* w = model->weights;
+    for (int l = 0; l < mlp->nlayers; l++) {
+        Layer* layer = mlp->layers[l];
+        int nin = layer->neurons[0]->nin;
+        for (int i = 0; i < nin; i++) {
+            for (int j = 0; j < layer->nout; j++) {
+                layer->neurons[j]->w[i]->val = *w++;
+            }
+        }
+        for (int j = 0; j < layer->nout; j++) {
+            layer->neurons[j]->b->val = *w++;
+        }
+    }
+    free_frozen_mlp(model);
+    return 0;
+}
+
 /**
  * @brief Free the memory allocated for a neuron.
  *
@@ -1,5 +1,6 @@
 #include "mlp.h"
 #include "load.h"
+#include "loader.h"
 
 // One-hot encoding of label. mlp will predict a (2,) dimensional vector, for classification.
 // So if label is 0 -> [1, 0], if 1 -> [0, 1]
@@ -35,51 +36,70 @@ int main() {
     // Init a MLP with custom layer sizes.
     MLP* mlp = init_mlp(sizes, nlayers);
 
-    // load data from data.txt
-    Entry* entries = load_data();
+    // stream data from data.txt, one "number label" pair per line, 5 lines at a time,
+    // keeping the first 25 examples as the training set, with their labels one-hot encoded once up front.
+    int n_train = 25;
+    float* train_x = (float*)malloc(n_train * inputs * sizeof(float));
+    float* train_y = (float*)malloc(n_train * labels * sizeof(float));
+    DataReader* reader = open_reader("data.txt", 2, 5, READER_CHUNK);
+    int n_read = 0;
+    int rows;
+    while (n_read < n_train && (rows = read_batch(reader)) > 0) {
+        for (int r = 0; r < rows && n_read < n_train; r++, n_read++) {
+            train_x[n_read] = reader->batch[2 * r];
+            float* encoded = one_hot_encode(reader->batch[2 * r + 1]);
+            memcpy(train_y + n_read * labels, encoded, labels * sizeof(float));
+            free(encoded);
+        }
+    }
+    close_reader(reader);
+    n_train = n_read;
 
     // Train for a n epochs.
     int epochs = 50;
 
+    // A background thread shuffles the training set every epoch and prepares the next minibatches of
+    // backward_freq examples while the current one trains, so the training loop never waits for its data.
+    BatchLoader* loader = start_loader(train_x, train_y, n_train, inputs, labels, backward_freq, epochs, 1, 2);
+
     float lr = 0.001;
     Value* total_loss = make_value(0.0);
     float epoch_loss = 0.0;
+    int ep = 0;
 
     // show_params(mlp);
-    for (int ep = 0; ep < epochs; ep++) {
-        for (int i=0; i < 25; i++) {
-            
-            float arr_x[] = {entries[i].number};
-            Value** x = make_values(arr_x, inputs);
-
-            float* arr_y = one_hot_encode(entries[i].label);
-            Value** y_true = make_values(arr_y, labels);
+    Batch* batch;
+    while ((batch = next_batch(loader)) != NULL) {
+        if (batch->epoch != ep) {
+            printf("\n\nEPOCH %i LOSSS: %f", ep, epoch_loss/n_train);
+            epoch_loss=0.0;
+            ep = batch->epoch;
+        }
+        for (int r = 0; r < batch->rows; r++) {
+            Value** x = make_values(batch->x + r * inputs, inputs);
+            Value** y_true = make_values(batch->y + r * labels, labels);
 
             Value* loss = train(mlp, x, y_true, lr);
             total_loss = add(total_loss, loss);
             epoch_loss+=total_loss->val;
-
-            // Backward pass
-            if (i%backward_freq==0){
-                // make loss.grad=1.0 (last node in mlp topo graph).
-                // grad is basically dy/da or dy/db where y = a op b; op can by anything add, sub, div ..
-                // in case of last node (which is the loss) -> a or b is itself y. since its the last node, and does have any op on it.
-                // so basically dy/dy = 1.0 
-                // This kicks off the gradient propogation backwards.
-                total_loss->grad=1.0;
-                backward(total_loss);
-                // resetting total_loss for a new epoch.
-                total_loss = make_value(0.0);
-            }
-            
-            
-            // show_params(mlp);
         }
-        printf("\n\nEPOCH %i LOSSS: %f", ep, epoch_loss/25);
-        epoch_loss=0.0;
-        
+
+        // Backward pass, once per minibatch.
+        // make loss.grad=1.0 (last node in mlp topo graph).
+        // grad is basically dy/da or dy/db where y = a op b; op can by anything add, sub, div ..
+        // in case of last node (which is the loss) -> a or b is itself y. since its the last node, and does have any op on it.
+        // so basically dy/dy = 1.0 
+        // This kicks off the gradient propogation backwards.
+        total_loss->grad=1.0;
+        backward(total_loss);
+        // resetting total_loss for the next minibatch.
+        total_loss = make_value(0.0);
     }
+    printf("\n\nEPOCH %i LOSSS: %f", ep, epoch_loss/n_train);
 
+    stop_loader(loader);
+    free(train_x);
+    free(train_y);
     free_mlp(mlp);
 
     return 0;
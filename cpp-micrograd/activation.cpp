@@ -0,0 +1,108 @@
+#include <cmath>
+#include "activation.h"
+
+/**
+     * @brief y = act(z) for n values of type T.
+     * The switch is outside the loops, so every loop is a plain elementwise pass the compiler can vectorize
+     * (the ones calling expf/tanhf only with a vector math library, for ex. -O3 -ffast-math on glibc).
+     * Act::GELU is the tanh approximation: 0.5 z (1 + tanh(sqrt(2/pi) (z + 0.044715 z^3))).
+     * z and y may be the same array.
+*/
+template <typename T>
+static void forward(Act act, const T* z, T* y, uint32_t n) {
+    switch (act) {
+        case Act::NONE:
+            for (uint32_t i = 0; i < n; ++i) {
+                y[i] = z[i];
+            }
+            break;
+        case Act::RELU:
+            for (uint32_t i = 0; i < n; ++i) {
+                y[i] = z[i] > 0 ? z[i] : T(0);
+            }
+            break;
+        case Act::LEAKY_RELU:
+            for (uint32_t i = 0; i < n; ++i) {
+                y[i] = z[i] > 0 ? z[i] : T(LEAKY_RELU_ALPHA) * z[i];
+            }
+            break;
+        case Act::TANH:
+            for (uint32_t i = 0; i < n; ++i) {
+                y[i] = std::tanh(z[i]);
+            }
+            break;
+        case Act::SIGMOID:
+            for (uint32_t i = 0; i < n; ++i) {
+                y[i] = T(1) / (T(1) + std::exp(-z[i]));
+            }
+            break;
+        case Act::GELU:
+            for (uint32_t i = 0; i < n; ++i) {
+                T u = T(0.7978845608) * (z[i] + T(0.044715) * z[i] * z[i] * z[i]);
+                y[i] = T(0.5) * z[i] * (T(1) + std::tanh(u));
+            }
+            break;
+    }
+}
+
+/**
+     * @brief dz += dy * act'(z) for n values of type T, where y = act(z) was the output of the forward.
+     * Most of the derivatives are cheaper in terms of y, so both are passed in.
+*/
+template <typename T>
+static void backward(Act act, const T* z, const T* y, const T* dy, T* dz, uint32_t n) {
+    switch (act) {
+        case Act::NONE:
+            for (uint32_t i = 0; i < n; ++i) {
+                dz[i] += dy[i];
+            }
+            break;
+        case Act::RELU:
+            for (uint32_t i = 0; i < n; ++i) {
+                dz[i] += z[i] > 0 ? dy[i] : T(0);
+            }
+            break;
+        case Act::LEAKY_RELU:
+            for (uint32_t i = 0; i < n; ++i) {
+                dz[i] += z[i] > 0 ? dy[i] : T(LEAKY_RELU_ALPHA) * dy[i];
+            }
+            break;
+        case Act::TANH:
+            for (uint32_t i = 0; i < n; ++i) {
+                dz[i] += (T(1) - y[i] * y[i]) * dy[i];
+            }
+            break;
+        case Act::SIGMOID:
+            for (uint32_t i = 0; i < n; ++i) {
+                dz[i] += y[i] * (T(1) - y[i]) * dy[i];
+            }
+            break;
+        case Act::GELU:
+            for (uint32_t i = 0; i < n; ++i) {
+                T u = T(0.7978845608) * (z[i] + T(0.044715) * z[i] * z[i] * z[i]);
+                T t = std::tanh(u);
+                T du = T(0.7978845608) * (T(1) + 3 * T(0.044715) * z[i] * z[i]);
+                dz[i] += (T(0.5) * (T(1) + t) + T(0.5) * z[i] * (T(1) - t * t) * du) * dy[i];
+            }
+            break;
+    }
+}
+
+/**
+     * @brief The float and double versions, both compiled from the templates above.
+*/
+void activate_forward(Act act, const float* z, float* y, uint32_t n) {
+    forward(act, z, y, n);
+}
+
+void activate_forward(Act act, const double* z, double* y, uint32_t n) {
+    forward(act, z, y, n);
+}
+
+void activate_backward(Act act, const float* z, const float* y, const float* dy, float* dz, uint32_t n) {
+    backward(act, z, y, dy, dz, n);
+}
+
+void activate_backward(Act act, const double* z, const double* y, const double* dy, double* dz, uint32_t n) {
+    backward(act, z, y, dy, dz, n);
+}
@@ -0,0 +1,23 @@
+#ifndef ACTIVATION_H
+#define ACTIVATION_H
+
+#include <cstdint>
+
+enum class Act : uint8_t {
+    NONE,
+    RELU,
+    LEAKY_RELU,
+    TANH,
+    SIGMOID,
+    GELU,
+};
+
+// Slope of Act::LEAKY_RELU for negative inputs.
+constexpr double LEAKY_RELU_ALPHA = 0.01;
+
+void activate_forward(Act act, const float* z, float* y, uint32_t n);
+void activate_forward(Act act, const double* z, double* y, uint32_t n);
+void activate_backward(Act act, const float* z, const float* y, const float* dy, float* dz, uint32_t n);
+void activate_backward(Act act, const double* z, const double* y, const double* dy, double* dz, uint32_t n);
+
+#endif
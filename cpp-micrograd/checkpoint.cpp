@@ -0,0 +1,134 @@
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "checkpoint.h"
+
+/**
+    * @brief The checkpoint format: one file holding an MLP's layer sizes, its weights and optionally its optimizer state.
+
+    * The weights are stored the way FrozenMLP uses them, every layer as its transposed [nin, nout] weights followed by
+    * its nout biases, so a model can be served straight out of the mapped file (see FrozenMLP::load()).
+    * MLP::load() and c-micrograd's load_mlp() copy them back into their own layouts.
+    * Integers and floats are in the byte order of the machine that wrote the file (little endian in practice),
+    * and the sections start on 64 byte boundaries so the floats are aligned for vector loads.
+    * c-micrograd reads and writes the same format, so a model trained with one can be loaded into the other.
+*/
+
+static uint64_t align64(uint64_t offset) {
+    return (offset + 63) & ~uint64_t(63);
+}
+
+/**
+    * @brief Writes a checkpoint to path, replacing it if it exists.
+    * The file is written as path + ".tmp", synced to disk and renamed over path, so path always holds a whole checkpoint,
+    * even after a crash mid-write, and a Checkpoint or FrozenMLP still mapping the old file keeps seeing the old contents.
+    * Throws std::runtime_error if the file cannot be written.
+*/
+void Checkpoint::write(const std::string& path, const std::vector<uint32_t>& sizes, const std::vector<Act>& acts,
+                       const float* weights, uint64_t n_weights, const float* state, uint64_t n_state) {
+    CheckpointHeader header = {};
+    std::memcpy(header.magic, "MGRADCKP", 8);
+    header.version = CHECKPOINT_VERSION;
+    header.nlayers = acts.size();
+    header.n_weights = n_weights;
+    header.n_state = n_state;
+    header.weights_offset = align64(sizeof(header) + (sizes.size() + acts.size()) * sizeof(uint32_t));
+    header.state_offset = n_state ? align64(header.weights_offset + n_weights * sizeof(float)) : 0;
+
+    std::vector<uint32_t> shape(sizes);
+    for (Act act: acts) {
+        shape.push_back(static_cast<uint32_t>(act));
+    }
+
+    std::string tmp = path + ".tmp";
+    FILE* file = std::fopen(tmp.c_str(), "wb");
+    if (!file) {
+        throw std::runtime_error("Checkpoint: cannot open " + tmp + " for writing");
+    }
+    static const char zeros[64] = {};
+    uint64_t padding = header.weights_offset - sizeof(header) - shape.size() * sizeof(uint32_t);
+    bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1
+        && std::fwrite(shape.data(), sizeof(uint32_t), shape.size(), file) == shape.size()
+        && std::fwrite(zeros, 1, padding, file) == padding
+        && std::fwrite(weights, sizeof(float), n_weights, file) == n_weights;
+    if (ok && n_state) {
+        padding = header.state_offset - header.weights_offset - n_weights * sizeof(float);
+        ok = std::fwrite(zeros, 1, padding, file) == padding
+            && std::fwrite(state, sizeof(float), n_state, file) == n_state;
+    }
+    ok = ok && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = std::fclose(file) == 0 && ok;
+    ok = ok && std::rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Checkpoint: failed to write " + path);
+    }
+}
+
+/**
+    * @brief Maps the checkpoint at path, read-only.
+    * Only the header is checked here: throws std::runtime_error if the file cannot be mapped, is not a checkpoint,
+    * has another version, is shorter than its header says, has a section that is not 64 byte aligned past the shape,
+    * or an activation this build does not know.
+*/
+Checkpoint::Checkpoint(const std::string& path) : mapping(MAP_FAILED), length(0), header(nullptr) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Checkpoint: cannot open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size >= static_cast<off_t>(sizeof(CheckpointHeader))) {
+        length = info.st_size;
+        mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Checkpoint: cannot map " + path);
+    }
+
+    header = static_cast<const CheckpointHeader*>(mapping);
+    const char* error = nullptr;
+    if (std::memcmp(header->magic, "MGRADCKP", 8) != 0) {
+        error = "not a checkpoint";
+    } else if (header->version != CHECKPOINT_VERSION) {
+        error = "unsupported version";
+    } else {
+        // Every section has to start on a 64 byte boundary past the shape, and fit in the file.
+        // The sizes are compared against what is left after the offset, so a corrupt count cannot overflow past the check.
+        uint64_t shape_end = sizeof(CheckpointHeader) + (2 * uint64_t(header->nlayers) + 1) * sizeof(uint32_t);
+        if (shape_end > length
+            || header->weights_offset > length || header->n_weights > (length - header->weights_offset) / sizeof(float)
+            || header->state_offset > length || header->n_state > (length - header->state_offset) / sizeof(float)) {
+            error = "truncated";
+        } else if (header->weights_offset % 64 != 0 || header->weights_offset < shape_end
+                   || (header->state_offset != 0 && (header->state_offset % 64 != 0 || header->state_offset < shape_end))
+                   || (header->n_state != 0 && header->state_offset == 0)) {
+            error = "misplaced section";
+        }
+        for (uint32_t l = 0; !error && l < header->nlayers; ++l) {
+            if (sizes()[header->nlayers + 1 + l] > static_cast<uint32_t>(Act::GELU)) {
+                error = "unknown activation";
+            }
+        }
+    }
+    if (error) {
+        munmap(mapping, length);
+        throw std::runtime_error("Checkpoint: " + path + ": " + error);
+    }
+}
+
+Checkpoint::~Checkpoint() {
+    munmap(mapping, length);
+}
+
+const float* Checkpoint::weights() const {
+    return reinterpret_cast<const float*>(static_cast<const char*>(mapping) + header->weights_offset);
+}
+
+const float* Checkpoint::state() const {
+    return header->n_state ? reinterpret_cast<const float*>(static_cast<const char*>(mapping) + header->state_offset) : nullptr;
+}
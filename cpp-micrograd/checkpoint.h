@@ -0,0 +1,56 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "activation.h"
+
+/**
+    * @brief Layout of the first bytes of a checkpoint file, shared with c-micrograd's checkpoint.h.
+    * It is followed by the nlayers + 1 layer sizes and the nlayers activations, as uint32_t,
+    * then by the weights and the optimizer state, as floats, each starting on a 64 byte boundary.
+*/
+struct CheckpointHeader {
+    char magic[8];           // "MGRADCKP"
+    uint32_t version;        // CHECKPOINT_VERSION
+    uint32_t nlayers;
+    uint64_t n_weights;
+    uint64_t n_state;        // 0 if there is no optimizer state
+    uint64_t weights_offset; // in bytes, from the start of the file
+    uint64_t state_offset;
+};
+
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+/**
+    * @brief A checkpoint file, mapped read-only into memory.
+    * Nothing is read or copied up front: weights() and state() point straight into the mapping,
+    * and the OS pages them in as they are used. The mapping lives as long as the Checkpoint.
+*/
+class Checkpoint {
+private:
+    void* mapping;
+    size_t length;
+    const CheckpointHeader* header;
+
+public:
+    explicit Checkpoint(const std::string& path);
+    ~Checkpoint();
+
+    Checkpoint(const Checkpoint&) = delete;
+    Checkpoint& operator=(const Checkpoint&) = delete;
+
+    static void write(const std::string& path, const std::vector<uint32_t>& sizes, const std::vector<Act>& acts,
+                      const float* weights, uint64_t n_weights, const float* state = nullptr, uint64_t n_state = 0);
+
+    uint32_t layers() const { return header->nlayers; }
+    const uint32_t* sizes() const { return reinterpret_cast<const uint32_t*>(header + 1); }
+    Act act(uint32_t layer) const { return static_cast<Act>(sizes()[layers() + 1 + layer]); }
+    const float* weights() const;
+    uint64_t weights_size() const { return header->n_weights; }
+    const float* state() const;
+    uint64_t state_size() const { return header->n_state; }
+};
+
+#endif
@@ -1,275 +1,1614 @@
-#include <functional>
-#include <unordered_set>
-#include <string>
 #include <iostream>
-#include <memory>
 #include <vector>
 #include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
 #include "engine.h"
+#include "gemm.h"
+#include "profile.h"
+
+/**
+    * @brief Node is the plain struct that actually lives in the computation graph.
+
+    * A Node holds no owning pointers, so a whole graph of them can be thrown away at once.
+    * Children are referred to by id (see Value), not by pointer, so the arena holding them is free to grow.
+
+    * @param data (type: T): The scalar value of this node.
+    * @param grad (type: T): gradient of the final node in the autograd graph, wrt this node.
+    * @param prev (type: uint32_t[2]): ids of the (at most two) Value objects that created this node.
+    * Op::DOT has more children than that, for it prev[0] is an offset into the arena's operand pool and prev[1] is the fan-in, see Value::dot().
+    * Op::FUSED nodes, made by optimize_graph(), keep their inputs and instructions in the operand pool as well: prev[0] is the offset and prev[1] the number of inputs.
+    * @param visit (type: uint32_t): the Arena epoch in which this node was last reached by a topological sort.
+    * @param op (type: Op): The operation (like +, *) that created this node, Op::LEAF for plain values.
+    * @param n_prev (type: uint8_t): how many entries of prev are in use.
+    * @param custom (type: uint16_t): what the op needs on top of its children: for Op::CUSTOM the id that Value::register_op() handed out,
+    * for Op::ACT and Op::DOT the Act, for Op::LOSS and Op::BATCH_LOSS the Loss, and CONSTANT_LEAF for the constants of Arena::constant().
+    * Other ops leave it 0.
+
+    * There is no per-node closure: Value::backward() switches on op and applies the chain rule itself.
+    * The whole struct is 24 bytes for float (32 for double) and owns nothing.
+*/
+
+/**
+     * @brief The functions of custom ops, indexed by the id register_op() returned.
+*/
+template <typename T>
+struct CustomOp {
+    BasicBackwardFn<T> backward;
+    BasicForwardFn<T> forward;
+};
+
+template <typename T>
+static std::vector<CustomOp<T>>& custom_ops() {
+    static std::vector<CustomOp<T>> ops;
+    return ops;
+}
+
+/**
+     * @brief Loss of one row of n predictions against n targets.
+     * Loss::MSE is the mean of (pred - target)^2.
+     * Loss::CROSS_ENTROPY is -sum target * log(softmax(pred)), for ex. with a one-hot target. It is computed as
+     * sum(target) * logsumexp(pred) - sum(target * pred), with the largest pred subtracted before exp(), so it never overflows
+     * and the softmax itself is never rounded to 0 and fed to log().
+*/
+template <typename T>
+static T loss_forward(Loss kind, const T* pred, const T* target, uint32_t n) {
+    if (kind == Loss::MSE) {
+        T sum = 0.0;
+        for (uint32_t i = 0; i < n; ++i) {
+            T diff = pred[i] - target[i];
+            sum += diff * diff;
+        }
+        return sum / n;
+    }
+
+    T top = pred[0];
+    for (uint32_t i = 1; i < n; ++i) {
+        top = std::max(top, pred[i]);
+    }
+    T exp_sum = 0.0, target_sum = 0.0, dot = 0.0;
+    for (uint32_t i = 0; i < n; ++i) {
+        exp_sum += std::exp(pred[i] - top);
+        target_sum += target[i];
+        dot += target[i] * pred[i];
+    }
+    return target_sum * (top + std::log(exp_sum)) - dot;
+}
+
+/**
+     * @brief dpred += g * dL/dpred for the loss of one row, in closed form:
+     * 2 (pred - target) / n for Loss::MSE, sum(target) * softmax(pred) - target for Loss::CROSS_ENTROPY.
+*/
+template <typename T>
+static void loss_backward(Loss kind, const T* pred, const T* target, uint32_t n, T g, T* dpred) {
+    if (kind == Loss::MSE) {
+        T scale = 2 * g / n;
+        for (uint32_t i = 0; i < n; ++i) {
+            dpred[i] += scale * (pred[i] - target[i]);
+        }
+        return;
+    }
+
+    T top = pred[0];
+    for (uint32_t i = 1; i < n; ++i) {
+        top = std::max(top, pred[i]);
+    }
+    T exp_sum = 0.0, target_sum = 0.0;
+    for (uint32_t i = 0; i < n; ++i) {
+        exp_sum += std::exp(pred[i] - top);
+        target_sum += target[i];
+    }
+    T scale = target_sum / exp_sum;
+    for (uint32_t i = 0; i < n; ++i) {
+        dpred[i] += g * (scale * std::exp(pred[i] - top) - target[i]);
+    }
+}
+
+/**
+     * @brief bias + w.x for the operand data of an Op::DOT node, laid out as [bias, w[0..n), x[0..n), ...].
+     * The products are kept in 8 independent partial sums, so the compiler can vectorize the loop.
+*/
+template <typename T>
+static T dot_product(const T* vals, uint32_t n) {
+    const T* wv = vals + 1;
+    const T* xv = vals + 1 + n;
+    T partial[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (uint32_t j = 0; j < 8; ++j) {
+            partial[j] += wv[i + j] * xv[i + j];
+        }
+    }
+    for (; i < n; ++i) {
+        partial[0] += wv[i] * xv[i];
+    }
+    T sum = vals[0];
+    for (uint32_t j = 0; j < 8; ++j) {
+        sum += partial[j];
+    }
+    return sum;
+}
+
+/**
+     * @brief One instruction of an Op::FUSED node: the same arithmetic as the case of op in Arena::forward().
+*/
+template <typename T>
+static T elementwise_forward(Op op, Act act, T a, T b) {
+    switch (op) {
+        case Op::ADD:
+            return a + b;
+        case Op::MUL:
+            return a * b;
+        case Op::POW:
+            return std::pow(a, b);
+        case Op::SUB:
+            return a - b;
+        case Op::DIV:
+            return a / b;
+        case Op::NEG:
+            return -a;
+        case Op::ACT: {
+            T y;
+            activate_forward(act, &a, &y, 1);
+            return y;
+        }
+        default:
+            return a;
+    }
+}
+
+/**
+     * @brief Backward of one instruction of an Op::FUSED node: adds to da and then db exactly what Arena::backward() adds for op,
+     * so a fused chain leaves the same bits in every grad as the nodes it replaced. da and db may be the same slot, like in x * x.
+*/
+template <typename T>
+static void elementwise_backward(Op op, Act act, T a, T b, T out, T g, T& da, T& db) {
+    switch (op) {
+        case Op::ADD:
+            da += g;
+            db += g;
+            break;
+        case Op::MUL:
+            da += b * g;
+            db += a * g;
+            break;
+        case Op::POW:
+            da += b * std::pow(a, b - 1) * g;
+            break;
+        case Op::SUB:
+            da += g;
+            db -= g;
+            break;
+        case Op::DIV:
+            da += g / b;
+            db -= g * out / b;
+            break;
+        case Op::NEG:
+            da -= g;
+            break;
+        case Op::ACT:
+            activate_backward(act, &a, &out, &g, &da, 1);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+    * @brief Arena is a per-step bump allocator for Nodes.
+
+    * Every operation in a forward pass appends one Node to the end of the arena.
+    * Nodes are never freed one by one: once backward() is done and the gradients have been read,
+    * reset() drops the whole graph in O(1) by moving the top back to 0. The memory is kept for the next step.
+    * Next to the nodes the arena keeps an operand pool, where n-ary nodes like Op::DOT put their child ids and a copy of their children's data,
+    * and a float pool that holds the data and grad of matrix-valued nodes (see Tensor).
+
+    * Every thread has an arena of its own, so threads can build and backpropagate separate graphs at the same time.
+    * The ParamStore is shared though, see redirect_param_grads() for how threads keep their parameter grads apart.
+
+    * @param capacity number of nodes to reserve up front, the arena doubles whenever it runs out.
+*/
+template <typename T>
+BasicArena<T>::BasicArena(uint32_t capacity) {
+    PROFILE_ALLOC(uint64_t(capacity) * (sizeof(Node) + sizeof(uint32_t) + 2 * sizeof(T)));
+    nodes.resize(capacity);
+    top = 0;
+    operands.resize(capacity);
+    operand_data.resize(capacity);
+    operands_top = 0;
+    floats.resize(capacity);
+    floats_top = 0;
+    epoch = 0;
+    param_grad = nullptr;
+    param_first = 0;
+    std::fill(constants, constants + CONSTANT_SLOTS, UINT32_MAX);
+}
+
+/**
+     * @brief Retrieves the arena that new (non-parameter) Value objects are allocated in, one per thread.
+*/
+template <typename T>
+BasicArena<T>& BasicArena<T>::current() {
+    thread_local BasicArena arena;
+    return arena;
+}
+
+/**
+     * @brief Where backward() on this arena's graphs accumulates the grad of the parameter at index in the ParamStore.
+     * By default that is the ParamStore itself. After redirect_param_grads(buffer, first) it is buffer[index - first] instead:
+     * buffer holds the grads of the parameters from first on, for ex. those of one model (see Module::parameters()),
+     * and the graphs built in the meantime must not use any parameter outside of it. Pass nullptr to go back to the ParamStore.
+     * This is how data-parallel workers (see DataParallel) backpropagate at the same time without racing on the shared grads.
+*/
+template <typename T>
+T& BasicArena<T>::param_grad_at(uint32_t index) {
+    return param_grad ? param_grad[index - param_first] : ParamStore::global().grad_at(index);
+}
+
+/**
+     * @brief Bumps a copy of node onto the top of the arena.
+     * @return The id (type: uint32_t) of the new node.
+*/
+template <typename T>
+uint32_t BasicArena<T>::push(const Node& node) {
+    if (top == nodes.size()) {
+        PROFILE_ALLOC(nodes.size() * sizeof(Node));
+        nodes.resize(nodes.size() * 2);
+    }
+    PROFILE_NODE(node.op);
+    nodes[top] = node;
+    nodes[top].visit = 0;
+    return top++;
+}
+
+/**
+     * @brief Interns a constant: the id of a read-only leaf holding value, shared by every use of value in the graph.
+     * The arena keeps a small direct-mapped cache from the bits of a value to the last leaf it pushed for it,
+     * so for ex. the 2 of every `x * 2` in a step is a single node, and looking it up allocates nothing.
+     * An entry is checked against the node it points to before it is used, so entries left behind by release() simply miss.
+     * @return The id (type: uint32_t) of the constant's node.
+*/
+template <typename T>
+uint32_t BasicArena<T>::constant(T value) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(T));
+    // Fibonacci hashing, with the high half of a double folded in first so that round numbers do not collide.
+    uint32_t& slot = constants[((bits ^ (bits >> 32)) * 0x9E3779B97F4A7C15ull) >> 58];
+    if (slot < top && nodes[slot].op == Op::LEAF && nodes[slot].custom == CONSTANT_LEAF
+        && std::memcmp(&nodes[slot].data, &value, sizeof(T)) == 0) {
+        return slot;
+    }
+    slot = push({value, 0.0, {0, 0}, 0, Op::LEAF, 0, CONSTANT_LEAF});
+    return slot;
+}
+
+/**
+     * @brief Reserves count consecutive slots in the operand pool, each with room for an id and a float.
+     * @return The offset (type: uint32_t) of the first slot, stable until the slots are released.
+*/
+template <typename T>
+uint32_t BasicArena<T>::push_operands(uint32_t count) {
+    if (operands_top + count > operands.size()) {
+        size_t capacity = operands.size() * 2;
+        while (capacity < operands_top + count) {
+            capacity *= 2;
+        }
+        PROFILE_ALLOC((capacity - operands.size()) * (sizeof(uint32_t) + sizeof(T)));
+        operands.resize(capacity);
+        operand_data.resize(capacity);
+    }
+    uint32_t offset = operands_top;
+    operands_top += count;
+    return offset;
+}
+
+/**
+     * @brief Reserves count consecutive floats in the float pool.
+     * @return The offset (type: uint32_t) of the first one, stable until they are released.
+*/
+template <typename T>
+uint32_t BasicArena<T>::push_floats(uint32_t count) {
+    if (floats_top + count > floats.size()) {
+        size_t capacity = floats.size() * 2;
+        while (capacity < floats_top + count) {
+            capacity *= 2;
+        }
+        PROFILE_ALLOC((capacity - floats.size()) * sizeof(T));
+        floats.resize(capacity);
+    }
+    uint32_t offset = floats_top;
+    floats_top += count;
+    return offset;
+}
+
+/**
+     * @brief Releases every node and operand bumped since mark() returned `mark`, in O(1).
+     * Ids of the released nodes must not be used afterwards, nodes below the mark are untouched.
+*/
+template <typename T>
+void BasicArena<T>::release(Mark mark) {
+    if (mark.nodes < top) {
+        top = mark.nodes;
+    }
+    if (mark.operands < operands_top) {
+        operands_top = mark.operands;
+    }
+    if (mark.floats < floats_top) {
+        floats_top = mark.floats;
+    }
+}
+
+/**
+     * @brief Releases every node in the arena in O(1). Ids handed out before the reset must not be used afterwards.
+*/
+template <typename T>
+void BasicArena<T>::reset() {
+    release({0, 0, 0});
+}
+
+/**
+     * @brief Retrieves the ids of a node's children, wherever they are stored.
+     * @param node the node to look at.
+     * @param count set to the number of children.
+     * @return Pointer (type: const uint32_t*) to the first child id.
+*/
+template <typename T>
+const uint32_t* BasicArena<T>::children(const Node& node, uint32_t& count) {
+    if (node.op == Op::DOT) {
+        count = 2 * node.prev[1] + 1;
+        return &operands[node.prev[0]];
+    }
+    if (node.op == Op::MEAN) {
+        count = node.prev[1];
+        return &operands[node.prev[0]];
+    }
+    if (node.op == Op::STACK) {
+        count = operands[node.prev[0]] * operands[node.prev[0] + 1];
+        return &operands[node.prev[0] + 3];
+    }
+    if (node.op == Op::LINEAR) {
+        count = 1;
+        return &operands[node.prev[0] + 5];
+    }
+    if (node.op == Op::LOSS) {
+        count = node.prev[1];
+        return &operands[node.prev[0]];
+    }
+    if (node.op == Op::BATCH_LOSS) {
+        count = 1;
+        return &operands[node.prev[0] + 3];
+    }
+    if (node.op == Op::FUSED) {
+        count = node.prev[1];
+        return &operands[node.prev[0] + 1];
+    }
+    count = node.n_prev;
+    return node.prev;
+}
+
+/**
+     * @brief Builds the topological order of every arena node reachable from root.
+     * The graph is walked with an explicit stack instead of recursion, so a long chain (like the act = act + x[i]*w[i] chain in a Neuron)
+     * can be as deep as memory allows without overflowing the call stack.
+     * Instead of a visited set, every call starts a new epoch and a node counts as visited once its `visit` equals that epoch,
+     * so no node is ever hashed and nothing has to be cleared between calls.
+     * Parameters are leaves and are never part of the order.
+     * @param root id of the node to start from, must be an arena node.
+     * @return The order (type: const std::vector<uint32_t>&), children before parents. It is reused by the next call.
+*/
+template <typename T>
+const std::vector<uint32_t>& BasicArena<T>::topo_sort(uint32_t root) {
+    PROFILE_SCOPE(ProfilePhase::TOPO_SORT);
+    if (++epoch == 0) {
+        // The counter wrapped around, so old stamps could look current again. Clear them once and start over.
+        for (uint32_t i = 0; i < top; ++i) {
+            nodes[i].visit = 0;
+        }
+        epoch = 1;
+    }
+
+    topo.clear();
+    stack.clear();
+    nodes[root].visit = epoch;
+    stack.push_back({root, 0});
+
+    // A node stays on the stack until all of its children are in topo, then it goes in after them.
+    // Next to each node the stack keeps how many of its children were already looked at, so wide nodes are scanned once.
+    while (!stack.empty()) {
+        uint32_t id = stack.back().first;
+        uint32_t& next = stack.back().second;
+        uint32_t count;
+        const uint32_t* prev = children(nodes[id], count);
+
+        uint32_t child = PARAM_BIT;
+        while (next < count) {
+            uint32_t candidate = prev[next++];
+            if (!(candidate & PARAM_BIT) && nodes[candidate].visit != epoch) {
+                child = candidate;
+                break;
+            }
+        }
+
+        if (child != PARAM_BIT) {
+            nodes[child].visit = epoch;
+            stack.push_back({child, 0});
+        } else {
+            topo.push_back(id);
+            stack.pop_back();
+        }
+    }
+    return topo;
+}
+
+/**
+     * @brief Recomputes the data of every node in order, from the current data of its children.
+     * The data of leaves (plain Values, Tensor::input(), parameters) is left alone, so whatever was written into them since is picked up.
+     * The grad of every node in order is zeroed on the way, so a backward over the same order can follow right away.
+     * This is what Tape replays, it allocates nothing.
+     * @param order node ids, children before parents, like the one topo_sort() returns.
+*/
+template <typename T>
+void BasicArena<T>::forward(const std::vector<uint32_t>& order) {
+    PROFILE_SCOPE(ProfilePhase::FORWARD);
+    ParamStore& params = ParamStore::global();
+
+    auto data_of = [&](uint32_t id) -> T {
+        return (id & PARAM_BIT) ? params.data_at(id & ~PARAM_BIT) : nodes[id].data;
+    };
+
+    for (uint32_t id : order) {
+        Node& node = nodes[id];
+        node.grad = 0.0;
+        switch (node.op) {
+            case Op::LEAF:
+                break;
+            case Op::ADD:
+                node.data = data_of(node.prev[0]) + data_of(node.prev[1]);
+                break;
+            case Op::MUL:
+                node.data = data_of(node.prev[0]) * data_of(node.prev[1]);
+                break;
+            case Op::POW:
+                node.data = std::pow(data_of(node.prev[0]), data_of(node.prev[1]));
+                break;
+            case Op::SUB:
+                node.data = data_of(node.prev[0]) - data_of(node.prev[1]);
+                break;
+            case Op::DIV:
+                node.data = data_of(node.prev[0]) / data_of(node.prev[1]);
+                break;
+            case Op::NEG:
+                node.data = -data_of(node.prev[0]);
+                break;
+            case Op::DOT: {
+                uint32_t n = node.prev[1];
+                const uint32_t* ids = operands_at(node.prev[0]);
+                T* vals = operand_data_at(node.prev[0]);
+                for (uint32_t i = 0; i < 2 * n + 1; ++i) {
+                    vals[i] = data_of(ids[i]);
+                }
+                vals[2 * n + 1] = dot_product(vals, n);
+                activate_forward(static_cast<Act>(node.custom), &vals[2 * n + 1], &node.data, 1);
+                break;
+            }
+            case Op::MEAN: {
+                uint32_t n = node.prev[1];
+                const uint32_t* ids = operands_at(node.prev[0]);
+                T sum = 0.0;
+                for (uint32_t i = 0; i < n; ++i) {
+                    sum += data_of(ids[i]);
+                }
+                node.data = sum / n;
+                break;
+            }
+            case Op::INPUT: {
+                const uint32_t* info = operands_at(node.prev[0]);
+                uint32_t size = info[0] * info[1];
+                std::fill(floats_at(info[2]) + size, floats_at(info[2]) + 2 * size, T(0));
+                break;
+            }
+            case Op::STACK: {
+                const uint32_t* info = operands_at(node.prev[0]);
+                uint32_t size = info[0] * info[1];
+                T* out = floats_at(info[2]);
+                for (uint32_t i = 0; i < size; ++i) {
+                    out[i] = data_of(info[3 + i]);
+                    out[size + i] = 0.0;
+                }
+                break;
+            }
+            case Op::LINEAR:
+                Tensor::linear_forward(*this, node);
+                break;
+            case Op::ELEM: {
+                const uint32_t* info = operands_at(nodes[node.prev[0]].prev[0]);
+                node.data = floats_at(info[2])[node.prev[1]];
+                break;
+            }
+            case Op::ACT: {
+                T z = data_of(node.prev[0]);
+                activate_forward(static_cast<Act>(node.custom), &z, &node.data, 1);
+                break;
+            }
+            case Op::LOSS: {
+                uint32_t n = node.prev[1];
+                const uint32_t* ids = operands_at(node.prev[0]);
+                T* vals = operand_data_at(node.prev[0]);
+                for (uint32_t i = 0; i < n; ++i) {
+                    vals[i] = data_of(ids[i]);
+                    if (ids[n + i] != NO_TARGET) {
+                        vals[n + i] = data_of(ids[n + i]);
+                    }
+                }
+                node.data = loss_forward(static_cast<Loss>(node.custom), vals, vals + n, n);
+                break;
+            }
+            case Op::BATCH_LOSS: {
+                const uint32_t* info = operands_at(node.prev[0]);
+                const T* pred = floats_at(operands_at(nodes[info[3]].prev[0])[2]);
+                const T* target = floats_at(info[2]);
+                T sum = 0.0;
+                for (uint32_t r = 0; r < info[0]; ++r) {
+                    sum += loss_forward(static_cast<Loss>(node.custom), pred + r * info[1], target + r * info[1], info[1]);
+                }
+                node.data = sum / info[0];
+                break;
+            }
+            case Op::FUSED: {
+                // Registers: the inputs, then one per instruction, see optimize_graph().
+                uint32_t n = node.prev[1];
+                const uint32_t* info = operands_at(node.prev[0]);
+                const uint32_t* code = info + 1 + n;
+                T* reg = operand_data_at(node.prev[0]) + 1;
+                for (uint32_t i = 0; i < n; ++i) {
+                    reg[i] = data_of(info[1 + i]);
+                }
+                for (uint32_t k = 0; k < info[0]; ++k, code += 4) {
+                    reg[n + k] = code[3] != UINT32_MAX ? reg[code[3]]
+                        : elementwise_forward(static_cast<Op>(code[0] & 0xff), static_cast<Act>(code[0] >> 8), reg[code[1]], reg[code[2]]);
+                }
+                node.data = reg[n + info[0] - 1];
+                break;
+            }
+            case Op::CUSTOM:
+                custom_ops<T>()[node.custom].forward(node);
+                break;
+        }
+    }
+}
+/**
+     * @brief Runs the chain rule over order, parents before children, i.e. order is walked from the back.
+     * The chain-rule for every built-in op lives right here in one switch, so the sweep is a tight loop with no indirect calls.
+     * Only Op::CUSTOM nodes call out to the function they were registered with.
+     * The grad of the root (the last entry of order) has to be set by the caller.
+     * @param order node ids, children before parents, like the one topo_sort() returns.
+*/
+template <typename T>
+void BasicArena<T>::backward(const std::vector<uint32_t>& order) {
+    PROFILE_SCOPE(ProfilePhase::BACKWARD);
+    ParamStore& params = ParamStore::global();
+    T* grads = param_grad ? param_grad : params.grad_data();
+    uint32_t first = param_grad ? param_first : 0;
+    // Same as data_ref()/grad_ref(), with the arena and the store looked up once for the whole sweep.
+    auto data_of = [&](uint32_t id) -> T {
+        return (id & PARAM_BIT) ? params.data_at(id & ~PARAM_BIT) : nodes[id].data;
+    };
+    auto grad_of = [&](uint32_t id) -> T& {
+        return (id & PARAM_BIT) ? grads[(id & ~PARAM_BIT) - first] : nodes[id].grad;
+    };
+
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        Node& node = nodes[*it];
+        switch (node.op) {
+            case Op::LEAF:
+                break;
+            case Op::ADD:
+                grad_of(node.prev[0]) += node.grad;
+                grad_of(node.prev[1]) += node.grad;
+                break;
+            case Op::MUL: {
+                T a = data_of(node.prev[0]);
+                T b = data_of(node.prev[1]);
+                grad_of(node.prev[0]) += b * node.grad;
+                grad_of(node.prev[1]) += a * node.grad;
+                break;
+            }
+            case Op::POW: {
+                T a = data_of(node.prev[0]);
+                T b = data_of(node.prev[1]);
+                grad_of(node.prev[0]) += b * std::pow(a, b - 1) * node.grad;
+                break;
+            }
+            case Op::SUB:
+                grad_of(node.prev[0]) += node.grad;
+                grad_of(node.prev[1]) -= node.grad;
+                break;
+            case Op::DIV: {
+                // d(a/b)/da = 1/b and d(a/b)/db = -a/b^2 = -(a/b)/b, so neither needs more than the node's own output.
+                T b = data_of(node.prev[1]);
+                grad_of(node.prev[0]) += node.grad / b;
+                grad_of(node.prev[1]) -= node.grad * node.data / b;
+                break;
+            }
+            case Op::NEG:
+                grad_of(node.prev[0]) -= node.grad;
+                break;
+            case Op::DOT: {
+                uint32_t n = node.prev[1];
+                const uint32_t* ids = operands_at(node.prev[0]);
+                const T* vals = operand_data_at(node.prev[0]);
+                // vals[2n+1] is the sum before the activation, so g is dL/d(sum).
+                T g = 0.0;
+                activate_backward(static_cast<Act>(node.custom), &vals[2 * n + 1], &node.data, &node.grad, &g, 1);
+                grad_of(ids[0]) += g;
+                for (uint32_t i = 0; i < n; ++i) {
+                    grad_of(ids[1 + i]) += vals[1 + n + i] * g;
+                    grad_of(ids[1 + n + i]) += vals[1 + i] * g;
+                }
+                break;
+            }
+            case Op::MEAN: {
+                uint32_t n = node.prev[1];
+                const uint32_t* ids = operands_at(node.prev[0]);
+                T g = node.grad / n;
+                for (uint32_t i = 0; i < n; ++i) {
+                    grad_of(ids[i]) += g;
+                }
+                break;
+            }
+            case Op::INPUT:
+                break;
+            case Op::STACK: {
+                const uint32_t* info = operands_at(node.prev[0]);
+                uint32_t size = info[0] * info[1];
+                const T* tgrad = floats_at(info[2]) + size;
+                for (uint32_t i = 0; i < size; ++i) {
+                    grad_of(info[3 + i]) += tgrad[i];
+                }
+                break;
+            }
+            case Op::LINEAR:
+                Tensor::linear_backward(*this, node);
+                break;
+            case Op::ELEM: {
+                const uint32_t* info = operands_at(nodes[node.prev[0]].prev[0]);
+                floats_at(info[2])[info[0] * info[1] + node.prev[1]] += node.grad;
+                break;
+            }
+            case Op::ACT: {
+                T z = data_of(node.prev[0]);
+                activate_backward(static_cast<Act>(node.custom), &z, &node.data, &node.grad, &grad_of(node.prev[0]), 1);
+                break;
+            }
+            case Op::LOSS: {
+                uint32_t n = node.prev[1];
+                const uint32_t* ids = operands_at(node.prev[0]);
+                const T* vals = operand_data_at(node.prev[0]);
+                scratch.assign(n, 0.0);
+                loss_backward(static_cast<Loss>(node.custom), vals, vals + n, n, node.grad, scratch.data());
+                for (uint32_t i = 0; i < n; ++i) {
+                    grad_of(ids[i]) += scratch[i];
+                }
+                break;
+            }
+            case Op::BATCH_LOSS: {
+                const uint32_t* info = operands_at(node.prev[0]);
+                const uint32_t* input = operands_at(nodes[info[3]].prev[0]);
+                const T* pred = floats_at(input[2]);
+                T* dpred = floats_at(input[2]) + info[0] * info[1];
+                const T* target = floats_at(info[2]);
+                for (uint32_t r = 0; r < info[0]; ++r) {
+                    loss_backward(static_cast<Loss>(node.custom), pred + r * info[1], target + r * info[1], info[1],
+                                  node.grad / info[0], dpred + r * info[1]);
+                }
+                break;
+            }
+            case Op::FUSED: {
+                // The instructions run backwards like the nodes they came from did, the grads of the nodes
+                // that were fused away live in scratch, and only the last instruction's (the root's) comes from outside.
+                uint32_t n = node.prev[1];
+                uint32_t ops = operands_at(node.prev[0])[0];
+                const uint32_t* ids = operands_at(node.prev[0]) + 1;
+                const uint32_t* code = ids + n;
+                const T* reg = operand_data_at(node.prev[0]) + 1;
+                scratch.assign(n + ops, 0.0);
+                scratch[n + ops - 1] = node.grad;
+                for (uint32_t k = ops; k-- > 0;) {
+                    const uint32_t* c = code + 4 * k;
+                    T& da = c[1] < n ? grad_of(ids[c[1]]) : scratch[c[1]];
+                    T& db = c[2] < n ? grad_of(ids[c[2]]) : scratch[c[2]];
+                    elementwise_backward(static_cast<Op>(c[0] & 0xff), static_cast<Act>(c[0] >> 8),
+                                         reg[c[1]], reg[c[2]], reg[n + k], scratch[n + k], da, db);
+                }
+                break;
+            }
+            case Op::CUSTOM:
+                custom_ops<T>()[node.custom].backward(node);
+                break;
+        }
+    }
+}
+
+/**
+    * @brief GraphScope owns the graph built while it is alive.
+
+    * It remembers the top of the arena when it is created and releases everything above it when it goes out of scope,
+    * so a training step written as `{ GraphScope step; forward; backward; update; }` can never leave its graph behind.
+    * Only the arena is touched, the parameters and their grads are kept.
+    * Scopes can be nested, an inner scope only releases what was built inside it.
+*/
+
+/**
+    * @brief ParamStore holds the data and grad of every parameter, outside of any Arena.
+
+    * Parameters (weights and biases) have to survive Arena::reset() between training steps,
+    * and they are always leaves of the graph, so all they need is a slot for data and one for grad.
+    * Both are a single flat, 64 byte aligned float buffer, and parameters created one after the other sit next to each other in them.
+*/
+template <typename T>
+BasicParamStore<T>& BasicParamStore<T>::global() {
+    static BasicParamStore store;
+    return store;
+}
+
+/**
+    * @brief Parameters is a view of a contiguous range of the ParamStore, for ex. all weights and biases of an MLP.
+
+    * It is only a first index and a count, so it is free to create and to pass around.
+    * data() and grad() give the raw float arrays of the range, so whole-model operations are plain loops over contiguous memory:
+    * zeroing the grads is a memset, and an SGD update is one axpy(size(), -lr, grad(), data()).
+    * Iterating over it gives a Value handle per parameter, for code that wants them one by one.
+    * The pointers are only valid until the next parameter is created, since the store may grow.
+*/
+
+/**
+     * @brief Appends a new parameter initialised to value, with zero grad.
+     * @return The id (type: uint32_t) of the new parameter.
+*/
+template <typename T>
+uint32_t BasicParamStore<T>::push(T value) {
+    PROFILE_ALLOC(2 * sizeof(T));
+    data.push_back(value);
+    grad.push_back(0.0);
+    return static_cast<uint32_t>(data.size() - 1);
+}
 
 /**
     * @brief Value class implements the fundamental building block of an autograd engine.
 
     * For simplicity, it accepts only scalars.
     * You can create a Value object simply by wrapping around any float.
-    * For ex. wrap a scalar, 2.5 in a Value class via `auto v1 = std::make_shared<Value>(2.5);`
+    * For ex. wrap a scalar, 2.5 in a Value class via `Value v1(2.5);`
     * Once you create a Value object for a scalar, it can be included as a node in the bigger neural network graph.
     * For more intuitive understanding of a node, its role in a nerual network graph, and how back prop comes into the picture check out `digin-micrograd-theory`.
 
+    * A Value is only a small handle (an id) that is cheap to copy around.
+    * Ordinary values are Nodes in the current Arena and go away with Arena::reset().
+    * Values created with Value::parameter() live in the ParamStore instead, the top bit of the id tells the two apart.
+
     * @param data (type: float): The scalar value wrapped in the Value object.
-    * @param grad (type: float): gradient of the final node in the autograd graph, wrt the current value object.
-    * @param prev (type: std::unordered_set<std::shared_ptr<Value>>): The set of Value objects that created the current Value object.
-    * @param op (type: std::string): The operation (like +, *) that was performed to create current value object.
-    * @param _backward: A lambda function representing the expression to calculate the derivative of the final node with respect to the current node (this Value object).
+*/
+template <typename T>
+BasicValue<T>::BasicValue(T data) {
+    Node node{data, 0.0, {0, 0}, 0, Op::LEAF, 0, 0};
+    id = Arena::current().push(node);
+}
 
+/**
+     * @brief Creates a Value that lives in the ParamStore, so it survives Arena::reset().
+     * Use this for anything that is trained, like the weights and bias of a Neuron.
+     * @param data (type: float): initial value of the parameter.
 */
+template <typename T>
+BasicValue<T> BasicValue<T>::parameter(T data) {
+    return Value(ParamStore::global().push(data) | PARAM_BIT, true);
+}
 
-Value::Value(float data, std::unordered_set<std::shared_ptr<Value>> prev, std::string op) {
-    this->data = data;
-    this->grad = 0.0;
-    this->prev = std::move(prev);
-    this->op = std::move(op);
-    this->_backward = [this] {
-        for (const auto& child : this->prev) {
-            child->_backward();
-        }
-    };
+/**
+     * @brief Bumps a new Node that was created by op out of a and b, and wraps it in a Value.
+*/
+template <typename T>
+BasicValue<T> BasicValue<T>::make(T data, const Value& a, const Value& b, Op op) {
+    Node node{data, 0.0, {a.id, b.id}, 0, op, 2, 0};
+    return Value(Arena::current().push(node), true);
+}
+
+/**
+     * @brief Same as above, for a unary op like Op::NEG.
+*/
+template <typename T>
+BasicValue<T> BasicValue<T>::make(T data, const Value& a, Op op) {
+    Node node{data, 0.0, {a.id, 0}, 0, op, 1, 0};
+    return Value(Arena::current().push(node), true);
+}
+
+/**
+     * @brief A constant, for ex. the 2 in `x * 2`, interned in the current Arena (see Arena::constant()).
+     * Every use of the same constant in a graph shares one leaf, so a constant costs no node per use and no allocation.
+     * The operators taking a plain number on either side go through this, so `x * 2`, `1 - x` or `x.pow(3)` are one node each.
+     * The leaf is shared, so unlike a `Value(2)` it must never be written to with set_data().
+*/
+template <typename T>
+BasicValue<T> BasicValue<T>::constant(T data) {
+    return Value(Arena::current().constant(data), true);
+}
+
+/**
+     * @brief Registers the backward function of an operation the engine does not know about.
+     * This is the escape hatch next to the built-in ops: register the backward once, then build nodes with Value::custom().
+     * For ex.
+     * static void square_backward(Node& out) {
+     *     Value::grad_ref(out.prev[0]) += 2 * Value::data_ref(out.prev[0]) * out.grad;
+     * }
+     * static const uint16_t SQUARE = Value::register_op(square_backward);
+     * auto y = Value::custom(x.get_data() * x.get_data(), SQUARE, x);
+
+     * @param backward function that pushes out.grad down to the children in out.prev.
+     * @param forward function that recomputes out.data from the children in out.prev. Only needed if the node is replayed by a Tape.
+     * @return The id (type: uint16_t) to pass to Value::custom().
+*/
+template <typename T>
+uint16_t BasicValue<T>::register_op(BasicBackwardFn<T> backward, BasicForwardFn<T> forward) {
+    custom_ops<T>().push_back({backward, forward});
+    return static_cast<uint16_t>(custom_ops<T>().size() - 1);
+}
+
+/**
+     * @brief Creates a node of a custom op with one child, the forward result is computed by the caller and passed in as data.
+*/
+template <typename T>
+BasicValue<T> BasicValue<T>::custom(T data, uint16_t op, const Value& a) {
+    Node node{data, 0.0, {a.id, 0}, 0, Op::CUSTOM, 1, op};
+    return Value(Arena::current().push(node), true);
+}
+
+/**
+     * @brief Creates a node of a custom op with two children, the forward result is computed by the caller and passed in as data.
+*/
+template <typename T>
+BasicValue<T> BasicValue<T>::custom(T data, uint16_t op, const Value& a, const Value& b) {
+    Node node{data, 0.0, {a.id, b.id}, 0, Op::CUSTOM, 2, op};
+    return Value(Arena::current().push(node), true);
+}
+
+/**
+     * @brief Resolves an id to the data slot it refers to, either in the ParamStore or in the current Arena.
+*/
+template <typename T>
+T& BasicValue<T>::data_ref(uint32_t id) {
+    if (id & PARAM_BIT) {
+        return ParamStore::global().data_at(id & ~PARAM_BIT);
+    }
+    return Arena::current()[id].data;
+}
+
+/**
+     * @brief Resolves an id to the grad slot it refers to, either in the current Arena
+     * or, for parameters, wherever the current Arena accumulates them (see Arena::param_grad_at()).
+*/
+template <typename T>
+T& BasicValue<T>::grad_ref(uint32_t id) {
+    if (id & PARAM_BIT) {
+        return Arena::current().param_grad_at(id & ~PARAM_BIT);
+    }
+    return Arena::current()[id].grad;
 }
 
 /**
      * @brief Retrieves the scalar value stored in the Value object.
      * @return The scalar value (type: float) wrapped in the Value object.
 */
-float Value::get_data() {
-    return data;
+template <typename T>
+T BasicValue<T>::get_data() const {
+    return data_ref(id);
 }
 
 /**
      * @brief Sets the scalar value stored in the Value object.
 */
-void Value::set_data(float data) {
-    this->data = data;
+template <typename T>
+void BasicValue<T>::set_data(T data) {
+    data_ref(id) = data;
 }
 
 
 /**
-     * @brief Retrieves the set of Value objects that created the current Value object.
-     * @return The set of Value objects (type: std::unordered_set<std::shared_ptr<Value>>) that created the current Value object.
+     * @brief Retrieves the Value objects that created the current Value object.
+     * @return The Value objects (type: std::vector<Value>) that created the current Value object.
 */
-std::unordered_set<std::shared_ptr<Value>> Value::get_prev() const {
+template <typename T>
+std::vector<BasicValue<T>> BasicValue<T>::get_prev() const {
+    std::vector<Value> prev;
+    if (is_parameter()) {
+        return prev;
+    }
+    Arena& arena = Arena::current();
+    uint32_t count;
+    const uint32_t* ids = arena.children(arena[id], count);
+    for (uint32_t i = 0; i < count; ++i) {
+        prev.push_back(Value(ids[i], true));
+    }
     return prev;
 }
 
+/**
+     * @brief Fused dot product of weights and inputs plus a bias, as a single node.
+     * It computes the same as bias + w[0]*x[0] + w[1]*x[1] + ... but instead of a mul and an add node per input
+     * it bumps one Op::DOT node, no matter how large the fan-in is.
+     * The children go to the arena's operand pool as [bias, w[0..n), x[0..n)], together with a copy of their data,
+     * so the forward is a plain loop over two contiguous float arrays (see dot_product()),
+     * and the backward can write dL/dw and dL/dx in the same pass without looking the data up again.
+     * An activation can be applied to the sum in the same node, the sum before it is kept in one more slot of the operand data for the backward.
+     * For ex.
+     * auto act = Value::dot(weights, x, bias, Act::RELU);
+
+     * @param w The weights, same length as x.
+     * @param x The inputs.
+     * @param bias Added to the dot product.
+     * @param act Activation applied to the sum.
+     * @return A new Value object representing act(bias + sum_i w[i]*x[i]).
+*/
+template <typename T>
+BasicValue<T> BasicValue<T>::dot(const std::vector<Value>& w, const std::vector<Value>& x, const Value& bias, Act act) {
+    Arena& arena = Arena::current();
+    uint32_t n = static_cast<uint32_t>(w.size());
+    uint32_t offset = arena.push_operands(2 * n + 2);
+    uint32_t* ids = arena.operands_at(offset);
+    T* vals = arena.operand_data_at(offset);
+
+    ids[0] = bias.id;
+    vals[0] = bias.get_data();
+    for (uint32_t i = 0; i < n; ++i) {
+        ids[1 + i] = w[i].id;
+        vals[1 + i] = w[i].get_data();
+        ids[1 + n + i] = x[i].id;
+        vals[1 + n + i] = x[i].get_data();
+    }
+
+    ids[2 * n + 1] = 0;
+    vals[2 * n + 1] = dot_product(vals, n);
+
+    Node node{0.0, 0.0, {offset, n}, 0, Op::DOT, 0, static_cast<uint16_t>(act)};
+    activate_forward(act, &vals[2 * n + 1], &node.data, 1);
+    return Value(arena.push(node), true);
+}
+
+/**
+     * @brief Mean of any number of Value objects, as a single node.
+     * Handy to average per-example losses over a minibatch, so that one backward() leaves the mean gradient in the parameters.
+     * For ex.
+     * auto loss = Value::mean(losses);
+
+     * @param values The Value objects to average, at least one.
+     * @return A new Value object representing (values[0] + ... + values[n-1]) / n.
+*/
+template <typename T>
+BasicValue<T> BasicValue<T>::mean(const std::vector<Value>& values) {
+    Arena& arena = Arena::current();
+    uint32_t n = static_cast<uint32_t>(values.size());
+    uint32_t offset = arena.push_operands(n);
+    uint32_t* ids = arena.operands_at(offset);
+
+    T sum = 0.0;
+    for (uint32_t i = 0; i < n; ++i) {
+        ids[i] = values[i].id;
+        sum += values[i].get_data();
+    }
+
+    Node node{sum / n, 0.0, {offset, n}, 0, Op::MEAN, 0, 0};
+    return Value(arena.push(node), true);
+}
+
+/**
+     * @brief Loss of a vector of predictions against plain float targets, as a single node (node type Op::LOSS).
+     * Instead of a few nodes and constants per element, the predictions go to the operand pool next to a copy of the targets,
+     * and forward and backward are one closed-form pass over them (see loss_forward() and loss_backward()).
+     * Use mse_loss() and softmax_cross_entropy() for the two kinds.
+
+     * @param kind Loss::MSE or Loss::CROSS_ENTROPY (the predictions are then logits).
+     * @param pred The predictions.
+     * @param target The targets, same length as pred.
+     * @return A new Value object holding the loss.
+*/
+template <typename T>
+BasicValue<T> BasicValue<T>::loss(Loss kind, const std::vector<Value>& pred, const std::vector<T>& target) {
+    Arena& arena = Arena::current();
+    uint32_t n = static_cast<uint32_t>(pred.size());
+    uint32_t offset = arena.push_operands(2 * n);
+    uint32_t* ids = arena.operands_at(offset);
+    T* vals = arena.operand_data_at(offset);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        ids[i] = pred[i].id;
+        vals[i] = pred[i].get_data();
+        ids[n + i] = NO_TARGET;
+        vals[n + i] = target[i];
+    }
+
+    Node node{loss_forward(kind, vals, vals + n, n), 0.0, {offset, n}, 0, Op::LOSS, 0, static_cast<uint16_t>(kind)};
+    return Value(arena.push(node), true);
+}
+
+/**
+     * @brief Same as above, but the targets are Values, whose ids are kept next to the copies of their data:
+     * every forward of the node (Tape::forward()) reads them again, so a replayed graph picks up new labels written with set_data().
+     * The targets are data, not part of the graph: they get no grad and should be leaves, for ex. Value(y).
+*/
+template <typename T>
+BasicValue<T> BasicValue<T>::loss(Loss kind, const std::vector<Value>& pred, const std::vector<Value>& target) {
+    Arena& arena = Arena::current();
+    uint32_t n = static_cast<uint32_t>(pred.size());
+    uint32_t offset = arena.push_operands(2 * n);
+    uint32_t* ids = arena.operands_at(offset);
+    T* vals = arena.operand_data_at(offset);
+
+    for (uint32_t i = 0; i < n; ++i) {
+        ids[i] = pred[i].id;
+        vals[i] = pred[i].get_data();
+        ids[n + i] = target[i].id;
+        vals[n + i] = target[i].get_data();
+    }
+
+    Node node{loss_forward(kind, vals, vals + n, n), 0.0, {offset, n}, 0, Op::LOSS, 0, static_cast<uint16_t>(kind)};
+    return Value(arena.push(node), true);
+}
+
+/**
+     * @brief Retrieves the operation that created the current Value object, parameters are always Op::LEAF.
+*/
+template <typename T>
+Op BasicValue<T>::get_op() const {
+    if (is_parameter()) {
+        return Op::LEAF;
+    }
+    return Arena::current()[id].op;
+}
+
 /**
      * @brief Retrieves the gradient value associated with the Value object.
      * @return The gradient value (type: float) associated with the Value object.
 */
-float Value::get_grad() const {
-    return grad;
+template <typename T>
+T BasicValue<T>::get_grad() const {
+    return grad_ref(id);
 }
 
 /**
      * @brief Sets the gradient value for the Value object.
      * @param grad_value The gradient value (type: float) to be set.
 */
-void Value::set_grad(float grad_value) {
-    this->grad=grad_value;
+template <typename T>
+void BasicValue<T>::set_grad(T grad_value) {
+    grad_ref(id) = grad_value;
 }
 
 /**
      * @brief Overloaded operator for addition of two Value objects.
-     * For ex. 
-     * auto v1 = std::make_shared<Value>(2.5);
-     * auto v2 = std::make_shared<Value>(3.5);
+     * For ex.
+     * Value v1(2.5);
+     * Value v2(3.5);
      * auto v1_2 = v1+v2;
      * defining the operator+ allows us to use the intuitive expression a+b.
 
      * @param other The other Value object to be added.
-     * @return A new Value object (type: std::shared_ptr<Value>) representing the sum of the two Value objects.
+     * @return A new Value object representing the sum of the two Value objects.
 */
-std::shared_ptr<Value> Value::operator+(const std::shared_ptr<Value>& other) {
-    auto out_prev = std::unordered_set<std::shared_ptr<Value>>{shared_from_this(), other};
-
-    auto out = std::make_shared<Value>(data + other->data, out_prev, "+");
-
-    out->_backward = [this, other, out] {
-        grad += out->grad;
-        other->grad += out->grad;
-
-    };
-    return out;
+template <typename T>
+BasicValue<T> BasicValue<T>::operator+(const Value& other) const {
+    return make(get_data() + other.get_data(), *this, other, Op::ADD);
 }
 
 /**
      * @brief Overloaded operator for negation of the Value object.
-     * For ex. 
-     * auto v1 = std::make_shared<Value>(2.5);
-     * auto v1 = -v1;
+     * For ex.
+     * Value v1(2.5);
+     * auto v2 = -v1;
      * defining the operator- allows us to use the intuitive expression (-b).
+     * It is a single Op::NEG node, with no constant to multiply by.
 
-     * @return A new Value object (type: std::shared_ptr<Value>) representing the negated Value object.
+     * @return A new Value object representing the negated Value object.
 */
-std::shared_ptr<Value> Value::operator-() {
-    return shared_from_this() * std::make_shared<Value>(-1.0);
+template <typename T>
+BasicValue<T> BasicValue<T>::operator-() const {
+    return make(-get_data(), *this, Op::NEG);
 }
 
 /**
      * @brief Overloaded operator for subtraction of two Value objects.
-     * For ex. 
-     * auto v1 = std::make_shared<Value>(2.5);
-     * auto v2 = std::make_shared<Value>(3.5);
+     * For ex.
+     * Value v1(2.5);
+     * Value v2(3.5);
      * auto v1_2 = v1-v2;
-     * defining the operator- allows us to use the intuitive expression a+(-b).
+     * defining the operator- allows us to use the intuitive expression a-b.
+     * It is a single Op::SUB node, instead of a negation and an addition.
 
      * @param other The other Value object to be subtracted.
-     * @return A new Value object (type: std::shared_ptr<Value>) representing the subtraction of the two Value objects.
+     * @return A new Value object representing the subtraction of the two Value objects.
 */
-std::shared_ptr<Value> Value::operator-(const std::shared_ptr<Value>& other) {
-    return shared_from_this() + (other->operator-());
+template <typename T>
+BasicValue<T> BasicValue<T>::operator-(const Value& other) const {
+    return make(get_data() - other.get_data(), *this, other, Op::SUB);
 }
 
 /**
-     * @brief Overloaded operator for power of two Value objects.
-     * For ex. 
-     * auto v1 = std::make_shared<Value>(2.5);
-     * auto v2 = std::make_shared<Value>(3.5);
-     * auto v1_2 = v1->pow(v2);
-     * defining the pow allows us to use the intuitive expression a->pow(b).
+     * @brief Power of two Value objects.
+     * For ex.
+     * Value v1(2.5);
+     * Value v2(3.5);
+     * auto v1_2 = v1.pow(v2);
+     * defining the pow allows us to use the intuitive expression a.pow(b).
 
      * @param other The other Value object which acts as the power.
-     * @return A new Value object (type: std::shared_ptr<Value>) representing v1^v2.
+     * @return A new Value object representing v1^v2.
 */
-std::shared_ptr<Value> Value::pow(const std::shared_ptr<Value>& other) {
-    auto out_prev = std::unordered_set<std::shared_ptr<Value>>{shared_from_this(), other};
-
-    auto out = std::make_shared<Value>(std::pow(data, other->data), out_prev, "^");
+template <typename T>
+BasicValue<T> BasicValue<T>::pow(const Value& other) const {
+    return make(std::pow(get_data(), other.get_data()), *this, other, Op::POW);
+}
 
-    out->_backward = [this, other, out] {
-        grad +=other->data * std::pow(data, other->data - 1) * out->grad;
+/**
+     * @brief Applies an activation function, as a single Op::ACT node.
+     * relu(), leaky_relu(), tanh(), sigmoid() and gelu() are shorthands for it.
+     * When the input is the output of a dot product or a linear layer, pass the activation to Value::dot() or Tensor::linear() instead,
+     * it is then applied inside that node and costs no node of its own.
+     * For ex.
+     * Value v(-0.5);
+     * auto out = v.relu();
 
-    };
-    return out;
+     * @param act The activation function.
+     * @return A new Value object representing act(v).
+*/
+template <typename T>
+BasicValue<T> BasicValue<T>::activate(Act act) const {
+    T z = get_data();
+    Node node{0.0, 0.0, {id, 0}, 0, Op::ACT, 1, static_cast<uint16_t>(act)};
+    activate_forward(act, &z, &node.data, 1);
+    return Value(Arena::current().push(node), true);
 }
 
 /**
      * @brief Overloaded operator for division of two Value objects.
-     * For ex. 
-     * auto v1 = std::make_shared<Value>(2.5);
-     * auto v2 = std::make_shared<Value>(3.5);
+     * For ex.
+     * Value v1(2.5);
+     * Value v2(3.5);
      * auto v1_2 = v1/v2;
      * defining the operator/ allows us to use the intuitive expression a/b.
+     * It is a single Op::DIV node, with no reciprocal and no std::pow() in forward or backward.
 
      * @param other The other Value object to be divided.
-     * @return A new Value object (type: std::shared_ptr<Value>) representing the division of the two Value objects.
+     * @return A new Value object representing the division of the two Value objects.
 */
-std::shared_ptr<Value> Value::operator/(const std::shared_ptr<Value>& other) {
-    return shared_from_this() * other->pow(std::make_shared<Value>(-1)) ;
+template <typename T>
+BasicValue<T> BasicValue<T>::operator/(const Value& other) const {
+    return make(get_data() / other.get_data(), *this, other, Op::DIV);
 }
 
 /**
      * @brief Overloaded operator for multiplication of two Value objects.
-     * For ex. 
-     * auto v1 = std::make_shared<Value>(2.5);
-     * auto v2 = std::make_shared<Value>(3.5);
+     * For ex.
+     * Value v1(2.5);
+     * Value v2(3.5);
      * auto v1_2 = v1*v2;
      * defining the operator* allows us to use the intuitive expression a*b.
 
      * @param other The other Value object to be multiplied.
-     * @return A new Value object (type: std::shared_ptr<Value>) representing the product of the two Value objects.
+     * @return A new Value object representing the product of the two Value objects.
 */
-std::shared_ptr<Value> Value::operator*(const std::shared_ptr<Value>& other) {
-    auto out_prev = std::unordered_set<std::shared_ptr<Value>>{shared_from_this(), other};
-
-    auto out = std::make_shared<Value>(data * other->data, out_prev, "*");
-
-    out->_backward = [this, other, out] {
-        grad += other->data * out->grad;
-        other->grad += data * out->grad;
-        
-    };
-    return out;
+template <typename T>
+BasicValue<T> BasicValue<T>::operator*(const Value& other) const {
+    return make(get_data() * other.get_data(), *this, other, Op::MUL);
 }
 
 /**
      * @brief Performs the backward pass for automatic differentiation using backpropagation.
      * Calculates the gradients for all the Value objects in the computation graph.
-     * Gradient of the top-most node is calculated first, and then correspondingly for lower nodes, via chain-rule implemented in each node's _backward function.
+     * Gradient of the top-most node is calculated first, and then correspondingly for lower nodes, via chain-rule (see Arena::backward()).
+     * Parameters are leaves, so only nodes of the current Arena take part in the topological sort.
      * For deeper intuition checkout `digin-micrograd-theory`.
-     
+
 */
-void Value::backward() {
-    std::vector<std::shared_ptr<Value>> topo;
-    std::unordered_set<std::shared_ptr<Value>> visited;
+template <typename T>
+void BasicValue<T>::backward() {
+    set_grad(1.0);
+    if (is_parameter()) {
+        return;
+    }
 
-    std::function<void(const std::shared_ptr<Value>&)> build_topo = [&](const std::shared_ptr<Value>& v) {
-        if (visited.find(v) == visited.end()) {
-            visited.insert(v);
+    Arena& arena = Arena::current();
+    arena.backward(arena.topo_sort(id));
+}
 
-            for (const auto& child : v->prev) {
-                build_topo(child);
-            }
-            topo.push_back(v);
+/**
+    * @brief Tensor is a handle to a matrix-valued node of the graph.
+
+    * Where a Value is one scalar, a Tensor is a whole row-major [rows, cols] matrix held by a single node,
+    * for ex. the [batch, nout] output of a Layer. Its data and grad live in the float pool of the Arena
+    * (grad right after data), so they are released together with the rest of the step's graph.
+    * Tensors are created from plain floats with Tensor::input() or from scalars with Tensor::stack(), pushed through Tensor::linear(),
+    * and turned back into scalars with operator() or row(), so they mix freely with ordinary Values and backward().
+
+    * Next to its node, every Tensor has a small record in the operand pool:
+    * [rows, cols, offset of data in the float pool, op specific fields ...]
+*/
+
+/**
+     * @brief Retrieves the record of this tensor in the operand pool.
+*/
+template <typename T>
+const uint32_t* BasicTensor<T>::info() const {
+    Arena& arena = Arena::current();
+    return arena.operands_at(arena[id].prev[0]);
+}
+
+template <typename T>
+uint32_t BasicTensor<T>::rows() const {
+    return info()[0];
+}
+
+template <typename T>
+uint32_t BasicTensor<T>::cols() const {
+    return info()[1];
+}
+
+/**
+     * @brief Retrieves the tensor's data, rows() * cols() floats in row-major order.
+*/
+template <typename T>
+T* BasicTensor<T>::data() const {
+    return Arena::current().floats_at(info()[2]);
+}
+
+/**
+     * @brief Retrieves the tensor's grad, same shape as data().
+*/
+template <typename T>
+T* BasicTensor<T>::grad() const {
+    return data() + rows() * cols();
+}
+
+/**
+     * @brief Creates a leaf tensor holding a copy of rows * cols floats given in row-major order.
+     * This is how a minibatch of inputs enters the graph without a Value per feature.
+     * For ex. a batch of two inputs with two features each:
+     * float batch[] = {0, 1, 1, 1};
+     * auto x = Tensor::input(batch, 2, 2);
+
+     * @param values The floats to copy.
+     * @param rows Rows of the tensor.
+     * @param cols Columns of the tensor.
+     * @return A new Tensor (node type Op::INPUT).
+*/
+template <typename T>
+BasicTensor<T> BasicTensor<T>::input(const T* values, uint32_t rows, uint32_t cols) {
+    Arena& arena = Arena::current();
+    uint32_t size = rows * cols;
+    uint32_t offset = arena.push_operands(3);
+    uint32_t data = arena.push_floats(2 * size);
+    uint32_t* info = arena.operands_at(offset);
+    T* out = arena.floats_at(data);
+
+    info[0] = rows;
+    info[1] = cols;
+    info[2] = data;
+    for (uint32_t i = 0; i < size; ++i) {
+        out[i] = values[i];
+        out[size + i] = 0.0;
+    }
+
+    Node node{0.0, 0.0, {offset, 0}, 0, Op::INPUT, 0, 0};
+    return Tensor(arena.push(node));
+}
+
+/**
+     * @brief Creates a tensor out of rows * cols scalar Values given in row-major order.
+     * For ex. a batch of two inputs with two features each:
+     * auto x = Tensor::stack({a0, a1, b0, b1}, 2, 2);
+
+     * @param values The scalars, their grads are filled in by backward.
+     * @param rows Rows of the tensor.
+     * @param cols Columns of the tensor.
+     * @return A new Tensor (node type Op::STACK).
+*/
+template <typename T>
+BasicTensor<T> BasicTensor<T>::stack(const std::vector<Value>& values, uint32_t rows, uint32_t cols) {
+    Arena& arena = Arena::current();
+    uint32_t size = rows * cols;
+    uint32_t offset = arena.push_operands(3 + size);
+    uint32_t data = arena.push_floats(2 * size);
+    uint32_t* info = arena.operands_at(offset);
+    T* out = arena.floats_at(data);
+
+    info[0] = rows;
+    info[1] = cols;
+    info[2] = data;
+    for (uint32_t i = 0; i < size; ++i) {
+        info[3 + i] = values[i].id;
+        out[i] = values[i].get_data();
+        out[size + i] = 0.0;
+    }
+
+    Node node{0.0, 0.0, {offset, 0}, 0, Op::STACK, 0, 0};
+    return Tensor(arena.push(node));
+}
+
+/**
+     * @brief Fully connected layer on a whole batch: out = x * W^T + b, as a single node.
+     * The weights come straight from the ParamStore, as a block of nout rows of nin + 1 parameters each,
+     * laid out as [b_j, w_j0, w_j1, ..., w_j(nin-1)]. This is exactly the order in which a Layer creates its Neurons' parameters.
+     * Forward and backward go through the blocked gemm() kernel, so for a [batch, nin] input this costs three matrix multiplies in total
+     * instead of batch * nout dot products, and the graph holds one node instead of batch * nout.
+     * An activation is applied in the same node: the forward runs it over the output right after the matrix multiply,
+     * and the backward folds its derivative into dY before the matrix multiplies. The output before the activation is kept
+     * after the output's grad in the float pool.
+
+     * @param x The [batch, nin] input.
+     * @param params ParamStore index of the first parameter of the block (b_0).
+     * @param nout Number of outputs.
+     * @param act Activation applied to every output.
+     * @return A new [batch, nout] Tensor (node type Op::LINEAR).
+*/
+template <typename T>
+BasicTensor<T> BasicTensor<T>::linear(const Tensor& x, uint32_t params, uint32_t nout, Act act) {
+    Arena& arena = Arena::current();
+    uint32_t batch = x.rows();
+    uint32_t nin = x.cols();
+    uint32_t offset = arena.push_operands(7);
+    uint32_t data = arena.push_floats((act == Act::NONE ? 2 : 3) * batch * nout);
+    uint32_t* info = arena.operands_at(offset);
+
+    info[0] = batch;
+    info[1] = nout;
+    info[2] = data;
+    info[3] = nin;
+    info[4] = params;
+    info[5] = x.id;
+    info[6] = static_cast<uint32_t>(act);
+
+    Node node{0.0, 0.0, {offset, 0}, 0, Op::LINEAR, 0, 0};
+    linear_forward(arena, node);
+    return Tensor(arena.push(node));
+}
+
+/**
+     * @brief Forward of Tensor::linear(): Y = act(b + X * W^T), with the output's grad zeroed.
+*/
+template <typename T>
+void BasicTensor<T>::linear_forward(Arena& arena, const Node& node) {
+    ParamStore& store = ParamStore::global();
+    const uint32_t* info = arena.operands_at(node.prev[0]);
+    uint32_t batch = info[0];
+    uint32_t nout = info[1];
+    uint32_t nin = info[3];
+    Act act = static_cast<Act>(info[6]);
+    T* out = arena.floats_at(info[2]);
+    T* pre = act == Act::NONE ? out : out + 2 * batch * nout;
+    const T* x = arena.floats_at(arena.operands_at(arena[info[5]].prev[0])[2]);
+
+    const T* w = &store.data_at(info[4]);
+    for (uint32_t b = 0; b < batch; ++b) {
+        for (uint32_t j = 0; j < nout; ++j) {
+            pre[b * nout + j] = w[j * (nin + 1)];
+            out[batch * nout + b * nout + j] = 0.0;
         }
-    };
+    }
+    gemm(false, true, batch, nout, nin, x, nin, w + 1, nin + 1, pre, nout);
+    if (act != Act::NONE) {
+        activate_forward(act, pre, out, batch * nout);
+    }
+}
+
+/**
+     * @brief Backward of Tensor::linear(), called from Arena::backward().
+     * With dY the [batch, nout] grad of the output (times the derivative of the activation, if there is one):
+     *     dX += dY * W      (into the input tensor's grad)
+     *     dW += dY^T * X    (into the parameters' grads)
+     *     db += column sums of dY
+*/
+template <typename T>
+void BasicTensor<T>::linear_backward(Arena& arena, const Node& node) {
+    ParamStore& store = ParamStore::global();
+    const uint32_t* info = arena.operands_at(node.prev[0]);
+    uint32_t batch = info[0];
+    uint32_t nout = info[1];
+    uint32_t nin = info[3];
+    Act act = static_cast<Act>(info[6]);
+    const T* dy = arena.floats_at(info[2]) + batch * nout;
+    if (act != Act::NONE) {
+        // Per thread, like gemm()'s packing buffers, and the output's own grad is left as it is.
+        thread_local std::vector<T> dz;
+        const T* y = arena.floats_at(info[2]);
+        dz.assign(batch * nout, 0.0);
+        activate_backward(act, y + 2 * batch * nout, y, dy, dz.data(), batch * nout);
+        dy = dz.data();
+    }
 
-    build_topo(shared_from_this());
+    const uint32_t* input = arena.operands_at(arena[info[5]].prev[0]);
+    const T* x = arena.floats_at(input[2]);
+    T* dx = arena.floats_at(input[2]) + batch * nin;
 
-    grad = 1.0;
+    const T* w = &store.data_at(info[4]);
+    T* dw = &arena.param_grad_at(info[4]);
 
-    for (auto it = topo.rbegin(); it != topo.rend(); ++it) {
-        const auto& v = *it;
-        v->_backward();
+    gemm(false, false, batch, nin, nout, dy, nout, w + 1, nin + 1, dx, nin);
+    gemm(true, false, nout, nin, batch, dy, nout, x, nin, dw + 1, nin + 1);
+    for (uint32_t b = 0; b < batch; ++b) {
+        for (uint32_t j = 0; j < nout; ++j) {
+            dw[j * (nin + 1)] += dy[b * nout + j];
+        }
     }
 }
 
-// Non-member operators for global-level access to expressing a+b etc..
+/**
+     * @brief Mean loss over the rows of a [rows, cols] tensor of predictions, as a single node (node type Op::BATCH_LOSS).
+     * Every row is one example, so this is the mean of Value::loss() over the examples of a minibatch,
+     * without a single scalar node per example. Its grad goes straight into the tensor's grad.
+
+     * @param kind Loss::MSE or Loss::CROSS_ENTROPY (the predictions are then logits).
+     * @param pred The predictions.
+     * @param target rows * cols targets in row-major order, copied into the arena.
+     * To replay the graph with other targets, pass them as a Tensor instead, see below.
+     * @return A new Value object holding the loss.
+*/
+template <typename T>
+BasicValue<T> BasicTensor<T>::loss(Loss kind, const Tensor& pred, const T* target) {
+    Arena& arena = Arena::current();
+    uint32_t rows = pred.rows();
+    uint32_t cols = pred.cols();
+    uint32_t offset = arena.push_operands(4);
+    uint32_t data = arena.push_floats(rows * cols);
+    uint32_t* info = arena.operands_at(offset);
+    T* copy = arena.floats_at(data);
+
+    info[0] = rows;
+    info[1] = cols;
+    info[2] = data;
+    info[3] = pred.id;
+    const T* values = pred.data();
+    T sum = 0.0;
+    for (uint32_t r = 0; r < rows; ++r) {
+        for (uint32_t c = 0; c < cols; ++c) {
+            copy[r * cols + c] = target[r * cols + c];
+        }
+        sum += loss_forward(kind, values + r * cols, copy + r * cols, cols);
+    }
+
+    Node node{sum / rows, 0.0, {offset, 0}, 0, Op::BATCH_LOSS, 0, static_cast<uint16_t>(kind)};
+    return Value(arena.push(node), true);
+}
 
 /**
- * @brief Overloaded operator for addition of two Value objects.
- * @param lhs The left-hand side Value object.
- * @param rhs The right-hand side Value object.
- * @return A new Value object (type: std::shared_ptr<Value>) representing the sum of the two Value objects.
- */
-std::shared_ptr<Value> operator+(const std::shared_ptr<Value>& lhs, const std::shared_ptr<Value>& rhs) {
-    return (*lhs) + rhs;
+     * @brief Same as above against a Tensor::input() of targets, whose data the node reads in place instead of copying it.
+     * Writing new labels into target.data() then rebinds them, like new inputs are written into the input tensor,
+     * so a Tape replays the graph on a new minibatch without rebuilding it. The target gets no grad.
+     * Throws std::invalid_argument if target is not a Tensor::input() of the same shape as pred.
+*/
+template <typename T>
+BasicValue<T> BasicTensor<T>::loss(Loss kind, const Tensor& pred, const Tensor& target) {
+    Arena& arena = Arena::current();
+    if (arena[target.id].op != Op::INPUT || target.rows() != pred.rows() || target.cols() != pred.cols()) {
+        throw std::invalid_argument("Tensor::loss: target must be a Tensor::input() of the same shape as the predictions");
+    }
+    uint32_t rows = pred.rows();
+    uint32_t cols = pred.cols();
+    uint32_t offset = arena.push_operands(4);
+    uint32_t* info = arena.operands_at(offset);
+
+    info[0] = rows;
+    info[1] = cols;
+    info[2] = target.info()[2];
+    info[3] = pred.id;
+    const T* values = pred.data();
+    const T* labels = target.data();
+    T sum = 0.0;
+    for (uint32_t r = 0; r < rows; ++r) {
+        sum += loss_forward(kind, values + r * cols, labels + r * cols, cols);
+    }
+
+    Node node{sum / rows, 0.0, {offset, 0}, 0, Op::BATCH_LOSS, 0, static_cast<uint16_t>(kind)};
+    return Value(arena.push(node), true);
 }
 
 /**
- * @brief Overloaded operator for subtraction of two Value objects.
- * @param lhs The left-hand side Value object.
- * @param rhs The right-hand side Value object.
- * @return A new Value object (type: std::shared_ptr<Value>) representing the subtraction of the two Value objects.
- */
-std::shared_ptr<Value> operator-(const std::shared_ptr<Value>& lhs, const std::shared_ptr<Value>& rhs) {
-    return (*lhs) - rhs;
+     * @brief Picks one element out of the tensor as a scalar Value (node type Op::ELEM), its grad flows back into the tensor's grad.
+*/
+template <typename T>
+BasicValue<T> BasicTensor<T>::operator()(uint32_t row, uint32_t col) const {
+    uint32_t index = row * cols() + col;
+    Node node{data()[index], 0.0, {id, index}, 0, Op::ELEM, 1, 0};
+    return Value(Arena::current().push(node), true);
 }
 
 /**
- * @brief Overloaded operator for multiplication of two Value objects.
- * @param lhs The left-hand side Value object.
- * @param rhs The right-hand side Value object.
- * @return A new Value object (type: std::shared_ptr<Value>) representing the product of the two Value objects.
- */
-std::shared_ptr<Value> operator*(const std::shared_ptr<Value>& lhs, const std::shared_ptr<Value>& rhs) {
-    return (*lhs) * rhs;
+     * @brief Picks a whole row out of the tensor as scalar Values, for ex. the outputs for one example of a batch.
+*/
+template <typename T>
+std::vector<BasicValue<T>> BasicTensor<T>::row(uint32_t row) const {
+    std::vector<Value> out;
+    out.reserve(cols());
+    for (uint32_t col = 0; col < cols(); ++col) {
+        out.push_back((*this)(row, col));
+    }
+    return out;
+}
+
+// Non-member functions for global-level access to expressing pow(a, b) etc..
+
+/**
+    * @brief Tape is a captured graph that can be run again and again without being rebuilt.
+
+    * For a fixed topology, like an MLP trained on same-sized batches, every step builds the exact same graph, only the numbers change.
+    * A Tape keeps the topological order of a graph built once, and replays it:
+    * forward() recomputes every node in place and backward() runs the chain-rule over the same order,
+    * so a step allocates nothing and does not sort the graph again.
+    * The inputs of the graph are its leaves: write new values into them with Value::set_data() or Tensor::data(),
+    * and the parameters are read from the ParamStore as they are. Targets are rebound the same way if the loss was built
+    * against a Tensor::input() or Values (see Tensor::loss() and Value::loss()), plain float targets are copied once and stay fixed.
+    * The graph has to stay in the Arena for as long as the Tape is used, i.e. within the GraphScope it was built in.
+
+    * For ex.
+    * GraphScope scope;
+    * Tensor x = Tensor::input(batch.data(), 4, 2);
+    * Tensor y = Tensor::input(labels.data(), 4, 2);
+    * Value loss = mse_loss(mlp(x), y);
+    * Tape tape(loss);
+    * for (...) { std::copy(next.begin(), next.end(), x.data()); std::copy(next_labels.begin(), next_labels.end(), y.data()); mlp.zero_grad(); tape.replay(); ... }
+
+    * @param root The output of the graph, usually the loss.
+*/
+template <typename T>
+BasicTape<T>::BasicTape(const Value& root) : arena(Arena::current()), root(root.get_id()) {
+    if (root.is_parameter()) {
+        return;
+    }
+    order = arena.topo_sort(this->root);
+    for (uint32_t id : order) {
+        const Node& node = arena[id];
+        if (node.op == Op::CUSTOM && custom_ops<T>()[node.custom].forward == nullptr) {
+            throw std::runtime_error("Tape: custom op was registered without a forward function");
+        }
+    }
 }
 
 /**
- * @brief Overloaded operator for division of two Value objects.
- * @param lhs The left-hand side Value object.
- * @param rhs The right-hand side Value object.
- * @return A new Value object (type: std::shared_ptr<Value>) representing the division of the two Value objects.
- */
-std::shared_ptr<Value> operator/(const std::shared_ptr<Value>& lhs, const std::shared_ptr<Value>& rhs) {
-    return (*lhs) / rhs;
+     * @brief Recomputes the whole graph from the current values of its leaves.
+     * @return The new value of the root.
+*/
+template <typename T>
+T BasicTape<T>::forward() {
+    arena.forward(order);
+    return Value::data_ref(root);
 }
 
 /**
- * @brief Overloaded operator for power of two Value objects.
- * @param lhs The left-hand side Value object.
- * @param rhs The right-hand side Value object.
- * @return A new Value object (type: std::shared_ptr<Value>) representing the power of the two Value objects.
- */
-std::shared_ptr<Value> pow(const std::shared_ptr<Value>& lhs, const std::shared_ptr<Value>& rhs) {
-    return lhs->pow(rhs);
-}
\ No newline at end of file
+     * @brief Backpropagates from the root, same as Value::backward() on it, but without sorting the graph again.
+     * The grads of the graph's nodes are reset by forward(), those of the parameters have to be zeroed by the caller.
+*/
+template <typename T>
+void BasicTape<T>::backward() {
+    Value::grad_ref(root) = 1.0;
+    arena.backward(order);
+}
+
+/**
+     * @brief forward() then backward(), i.e. one training step without the update.
+     * @return The new value of the root.
+*/
+template <typename T>
+T BasicTape<T>::replay() {
+    T out = forward();
+    backward();
+    return out;
+}
+
+// The engine is compiled once per scalar type here, everything else only sees the declarations.
+template class BasicArena<float>;
+template class BasicArena<double>;
+template class BasicParamStore<float>;
+template class BasicParamStore<double>;
+template class BasicValue<float>;
+template class BasicValue<double>;
+template class BasicTensor<float>;
+template class BasicTensor<double>;
+template class BasicTape<float>;
+template class BasicTape<double>;
@@ -1,43 +1,447 @@
 #ifndef ENGINE_H
 #define ENGINE_H
 
-#include <functional>
-#include <unordered_set>
-#include <string>
-#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+#include "activation.h"
 
+// Ids with this bit set refer to the ParamStore, all others to the current Arena.
+constexpr uint32_t PARAM_BIT = 0x80000000u;
 
-class Value : public std::enable_shared_from_this<Value> {
+// The custom field of an Op::LEAF node that holds an interned constant, see Arena::constant().
+constexpr uint16_t CONSTANT_LEAF = 1;
+// Number of slots of the constant cache of every Arena.
+constexpr uint32_t CONSTANT_SLOTS = 64;
+// The id an Op::LOSS node keeps for a plain float target, which is never read again.
+constexpr uint32_t NO_TARGET = 0xffffffffu;
+
+enum class Op : uint8_t {
+    LEAF,
+    ADD,
+    MUL,
+    POW,
+    SUB,
+    DIV,
+    NEG,
+    DOT,
+    MEAN,
+    INPUT,
+    STACK,
+    LINEAR,
+    ELEM,
+    ACT,
+    LOSS,
+    BATCH_LOSS,
+    FUSED,
+    CUSTOM,
+};
+
+enum class Loss : uint8_t {
+    MSE,
+    CROSS_ENTROPY,
+};
+
+template <typename T> class BasicArena;
+template <typename T> class BasicParamStore;
+template <typename T> class BasicValue;
+template <typename T> class BasicParameters;
+template <typename T> class BasicTensor;
+
+/**
+    * @brief The engine is a set of templates over the scalar type T of data and grad.
+    * float is the default, for throughput, and double is there for stable long reductions and reference runs.
+    * Both are instantiated once in engine.cpp, so picking one is a compile-time choice with nothing to dispatch at run time.
+    * The float ones keep their plain names (Node, Arena, Value, ...), the double ones are BasicValue<double> and so on.
+    * Inside the templates these plain names refer to the types of the same T.
+*/
+template <typename T>
+struct BasicNode {
+    T data;
+    T grad;
+    uint32_t prev[2];
+    uint32_t visit;
+    Op op;
+    uint8_t n_prev;
+    uint16_t custom;  // the op id of Op::CUSTOM nodes, the Act of Op::ACT and Op::DOT nodes, the Loss of Op::LOSS and Op::BATCH_LOSS nodes,
+                      // CONSTANT_LEAF for the constants of Arena::constant()
+};
+
+template <typename T> using BasicBackwardFn = void (*)(BasicNode<T>& out);
+template <typename T> using BasicForwardFn = void (*)(BasicNode<T>& out);
+
+template <typename T>
+class BasicArena {
+private:
+    typedef BasicNode<T> Node;
+    typedef BasicParamStore<T> ParamStore;
+    typedef BasicTensor<T> Tensor;
+
+    std::vector<Node> nodes;
+    uint32_t top;
+    std::vector<uint32_t> operands;
+    std::vector<T> operand_data;
+    uint32_t operands_top;
+    std::vector<T> floats;
+    uint32_t floats_top;
+    uint32_t epoch;
+    std::vector<uint32_t> topo;
+    std::vector<std::pair<uint32_t, uint32_t>> stack;
+    std::vector<T> scratch;
+    T* param_grad;
+    uint32_t param_first;
+    uint32_t constants[CONSTANT_SLOTS];
+
+public:
+    struct Mark {
+        uint32_t nodes;
+        uint32_t operands;
+        uint32_t floats;
+    };
+
+    explicit BasicArena(uint32_t capacity = 1 << 16);
+
+    static BasicArena& current();
+
+    uint32_t push(const Node& node);
+    uint32_t constant(T value);
+    Node& operator[](uint32_t id) { return nodes[id]; }
+    uint32_t size() const { return top; }
+    Mark mark() const { return {top, operands_top, floats_top}; }
+    void release(Mark mark);
+    void reset();
+
+    uint32_t push_operands(uint32_t count);
+    uint32_t* operands_at(uint32_t offset) { return &operands[offset]; }
+    T* operand_data_at(uint32_t offset) { return &operand_data[offset]; }
+    uint32_t push_floats(uint32_t count);
+    T* floats_at(uint32_t offset) { return &floats[offset]; }
+    const uint32_t* children(const Node& node, uint32_t& count);
+    uint32_t* children(Node& node, uint32_t& count) {
+        return const_cast<uint32_t*>(children(static_cast<const Node&>(node), count));
+    }
+
+    void redirect_param_grads(T* grad, uint32_t first = 0) { param_grad = grad; param_first = first; }
+    T& param_grad_at(uint32_t index);
+
+    const std::vector<uint32_t>& topo_sort(uint32_t root);
+    void forward(const std::vector<uint32_t>& order);
+    void backward(const std::vector<uint32_t>& order);
+};
+
+template <typename T>
+class BasicGraphScope {
+private:
+    BasicArena<T>& arena;
+    typename BasicArena<T>::Mark mark;
+
+public:
+    explicit BasicGraphScope(BasicArena<T>& arena = BasicArena<T>::current()) : arena(arena), mark(arena.mark()) {}
+    ~BasicGraphScope() { arena.release(mark); }
+
+    BasicGraphScope(const BasicGraphScope&) = delete;
+    BasicGraphScope& operator=(const BasicGraphScope&) = delete;
+};
+
+// Allocator for the ParamStore buffers, so they start on a cache line (and a 512-bit vector) boundary.
+template <typename T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    typedef T value_type;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+    template <typename U>
+    struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    T* allocate(std::size_t n) { return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment))); }
+    void deallocate(T* p, std::size_t) { ::operator delete(p, std::align_val_t(Alignment)); }
+
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+template <typename T>
+class BasicParamStore {
+private:
+    std::vector<T, AlignedAllocator<T>> data;
+    std::vector<T, AlignedAllocator<T>> grad;
+
+public:
+    static BasicParamStore& global();
+
+    uint32_t push(T value);
+    T& data_at(uint32_t id) { return data[id]; }
+    T& grad_at(uint32_t id) { return grad[id]; }
+    T* data_data() { return data.data(); }
+    T* grad_data() { return grad.data(); }
+    uint32_t size() const { return static_cast<uint32_t>(data.size()); }
+};
+
+template <typename T>
+class BasicValue {
+private:
+    typedef BasicNode<T> Node;
+    typedef BasicArena<T> Arena;
+    typedef BasicParamStore<T> ParamStore;
+    typedef BasicValue<T> Value;
+    friend class BasicTensor<T>;
+    friend class BasicParameters<T>;
+
+    uint32_t id;
+
+    explicit BasicValue(uint32_t id, bool) : id(id) {}
+    static Value make(T data, const Value& a, const Value& b, Op op);
+    static Value make(T data, const Value& a, Op op);
+
+public:
+    BasicValue(T data);
+    static Value parameter(T data);
+    static Value constant(T data);
+
+    static uint16_t register_op(BasicBackwardFn<T> backward, BasicForwardFn<T> forward = nullptr);
+    static Value custom(T data, uint16_t op, const Value& a);
+    static Value custom(T data, uint16_t op, const Value& a, const Value& b);
+    static Value dot(const std::vector<Value>& w, const std::vector<Value>& x, const Value& bias, Act act = Act::NONE);
+    static Value mean(const std::vector<Value>& values);
+    static Value loss(Loss kind, const std::vector<Value>& pred, const std::vector<T>& target);
+    static Value loss(Loss kind, const std::vector<Value>& pred, const std::vector<Value>& target);
+
+    bool is_parameter() const { return id & PARAM_BIT; }
+    uint32_t get_id() const { return id; }
+    Op get_op() const;
+
+    void set_grad(T grad_value);
+    T get_data() const;
+    void set_data(T data);
+    T get_grad() const;
+    std::vector<Value> get_prev() const;
+
+    Value operator+(const Value& other) const;
+    Value operator-() const;
+    Value operator-(const Value& other) const;
+    Value pow(const Value& other) const;
+    Value operator/(const Value& other) const;
+    Value operator*(const Value& other) const;
+
+    // With a plain number on either side, the number is an interned constant (see Value::constant()).
+    Value operator+(T other) const { return *this + constant(other); }
+    Value operator-(T other) const { return *this - constant(other); }
+    Value operator*(T other) const { return *this * constant(other); }
+    Value operator/(T other) const { return *this / constant(other); }
+    Value pow(T other) const { return pow(constant(other)); }
+    friend Value operator+(T lhs, const Value& rhs) { return constant(lhs) + rhs; }
+    friend Value operator-(T lhs, const Value& rhs) { return constant(lhs) - rhs; }
+    friend Value operator*(T lhs, const Value& rhs) { return constant(lhs) * rhs; }
+    friend Value operator/(T lhs, const Value& rhs) { return constant(lhs) / rhs; }
+
+    Value activate(Act act) const;
+    Value relu() const { return activate(Act::RELU); }
+    Value leaky_relu() const { return activate(Act::LEAKY_RELU); }
+    Value tanh() const { return activate(Act::TANH); }
+    Value sigmoid() const { return activate(Act::SIGMOID); }
+    Value gelu() const { return activate(Act::GELU); }
+
+    void backward();
+
+    static T& data_ref(uint32_t id);
+    static T& grad_ref(uint32_t id);
+};
+
+template <typename T>
+class BasicParameters {
 private:
-    float data;
-    float grad;
-    std::function<void()> _backward;
-    std::unordered_set<std::shared_ptr<Value>> prev;
-    std::string op;
+    typedef BasicParamStore<T> ParamStore;
+    typedef BasicValue<T> Value;
+
+    uint32_t first;
+    uint32_t count;
 
 public:
-    Value(float data, std::unordered_set<std::shared_ptr<Value>> prev = {}, std::string op = "");
+    class iterator {
+    private:
+        uint32_t index;
+
+    public:
+        explicit iterator(uint32_t index) : index(index) {}
+        Value operator*() const { return Value(index | PARAM_BIT, true); }
+        iterator& operator++() { ++index; return *this; }
+        bool operator!=(const iterator& other) const { return index != other.index; }
+    };
+
+    BasicParameters(uint32_t first = 0, uint32_t count = 0) : first(first), count(count) {}
 
-    void set_grad(float grad_value);
-    float get_data();
-    void set_data(float data);
-    float get_grad() const;
-    std::unordered_set<std::shared_ptr<Value>>  get_prev() const;
+    uint32_t size() const { return count; }
+    uint32_t offset() const { return first; }
+    T* data() const { return ParamStore::global().data_data() + first; }
+    T* grad() const { return ParamStore::global().grad_data() + first; }
+    Value operator[](uint32_t i) const { return Value((first + i) | PARAM_BIT, true); }
+    iterator begin() const { return iterator(first); }
+    iterator end() const { return iterator(first + count); }
+};
+
+template <typename T>
+class BasicTensor {
+private:
+    typedef BasicNode<T> Node;
+    typedef BasicArena<T> Arena;
+    typedef BasicParamStore<T> ParamStore;
+    typedef BasicValue<T> Value;
+    typedef BasicTensor<T> Tensor;
+    friend class BasicArena<T>;
 
-    std::shared_ptr<Value> operator+(const std::shared_ptr<Value>& other);
-    std::shared_ptr<Value> operator-();
-    std::shared_ptr<Value> operator-(const std::shared_ptr<Value>& other);
-    std::shared_ptr<Value> pow(const std::shared_ptr<Value>& other);
-    std::shared_ptr<Value> operator/(const std::shared_ptr<Value>& other);
-    std::shared_ptr<Value> operator*(const std::shared_ptr<Value>& other);
+    uint32_t id;
 
+    explicit BasicTensor(uint32_t id) : id(id) {}
+    const uint32_t* info() const;
+    static void linear_forward(Arena& arena, const Node& node);
+    static void linear_backward(Arena& arena, const Node& node);
+
+public:
+    static Tensor input(const T* values, uint32_t rows, uint32_t cols);
+    static Tensor stack(const std::vector<Value>& values, uint32_t rows, uint32_t cols);
+    static Tensor linear(const Tensor& x, uint32_t params, uint32_t nout, Act act = Act::NONE);
+    static Value loss(Loss kind, const Tensor& pred, const T* target);
+    static Value loss(Loss kind, const Tensor& pred, const Tensor& target);
+
+    uint32_t get_id() const { return id; }
+    uint32_t rows() const;
+    uint32_t cols() const;
+    T* data() const;
+    T* grad() const;
+
+    Value operator()(uint32_t row, uint32_t col) const;
+    std::vector<Value> row(uint32_t row) const;
+};
+
+template <typename T>
+class BasicTape {
+private:
+    typedef BasicNode<T> Node;
+    typedef BasicArena<T> Arena;
+    typedef BasicValue<T> Value;
+
+    Arena& arena;
+    uint32_t root;
+    std::vector<uint32_t> order;
+
+public:
+    explicit BasicTape(const Value& root);
+
+    T forward();
     void backward();
+    T replay();
+    uint32_t size() const { return static_cast<uint32_t>(order.size()); }
 };
 
-std::shared_ptr<Value> operator+(const std::shared_ptr<Value>& lhs, const std::shared_ptr<Value>& rhs);
-std::shared_ptr<Value> operator-(const std::shared_ptr<Value>& lhs, const std::shared_ptr<Value>& rhs);
-std::shared_ptr<Value> operator/(const std::shared_ptr<Value>& lhs, const std::shared_ptr<Value>& rhs);
-std::shared_ptr<Value> operator*(const std::shared_ptr<Value>& lhs, const std::shared_ptr<Value>& rhs);
-std::shared_ptr<Value> pow(const std::shared_ptr<Value>& lhs, const std::shared_ptr<Value>& rhs);
+typedef BasicNode<float> Node;
+typedef BasicBackwardFn<float> BackwardFn;
+typedef BasicForwardFn<float> ForwardFn;
+typedef BasicArena<float> Arena;
+typedef BasicGraphScope<float> GraphScope;
+typedef BasicParamStore<float> ParamStore;
+typedef BasicValue<float> Value;
+typedef BasicParameters<float> Parameters;
+typedef BasicTensor<float> Tensor;
+typedef BasicTape<float> Tape;
+
+/**
+ * @brief Power of two Value objects.
+ * @param lhs The base Value object.
+ * @param rhs The exponent Value object.
+ * @return A new Value object representing the power of the two Value objects.
+ */
+template <typename T>
+BasicValue<T> pow(const BasicValue<T>& lhs, const BasicValue<T>& rhs) {
+    return lhs.pow(rhs);
+}
+
+/**
+ * @brief Fused dot product of two vectors of Value objects plus a bias, see Value::dot().
+ * @param w The weights.
+ * @param x The inputs.
+ * @param bias Added to the dot product.
+ * @return A new Value object representing bias + sum_i w[i]*x[i].
+ */
+template <typename T>
+BasicValue<T> dot(const std::vector<BasicValue<T>>& w, const std::vector<BasicValue<T>>& x, const BasicValue<T>& bias, Act act = Act::NONE) {
+    return BasicValue<T>::dot(w, x, bias, act);
+}
+
+/**
+ * @brief Mean of a vector of Value objects, see Value::mean().
+ * @param values The Value objects to average.
+ * @return A new Value object representing their mean.
+ */
+template <typename T>
+BasicValue<T> mean(const std::vector<BasicValue<T>>& values) {
+    return BasicValue<T>::mean(values);
+}
+
+/**
+ * @brief Mean squared error of the predictions against the targets, as a single node, see Value::loss().
+ */
+template <typename T>
+BasicValue<T> mse_loss(const std::vector<BasicValue<T>>& pred, const std::vector<T>& target) {
+    return BasicValue<T>::loss(Loss::MSE, pred, target);
+}
+
+/**
+ * @brief Same as above against Values, read again on every forward, so a Tape can be replayed with new targets.
+ */
+template <typename T>
+BasicValue<T> mse_loss(const std::vector<BasicValue<T>>& pred, const std::vector<BasicValue<T>>& target) {
+    return BasicValue<T>::loss(Loss::MSE, pred, target);
+}
+
+/**
+ * @brief Mean squared error over a [batch, n] tensor of predictions, averaged over the batch, see Tensor::loss().
+ */
+template <typename T>
+BasicValue<T> mse_loss(const BasicTensor<T>& pred, const T* target) {
+    return BasicTensor<T>::loss(Loss::MSE, pred, target);
+}
+
+/**
+ * @brief Same as above against a Tensor::input() of targets, read in place, so a Tape can be replayed with new targets.
+ */
+template <typename T>
+BasicValue<T> mse_loss(const BasicTensor<T>& pred, const BasicTensor<T>& target) {
+    return BasicTensor<T>::loss(Loss::MSE, pred, target);
+}
+
+/**
+ * @brief Cross entropy of softmax(logits) against a target distribution (for ex. one-hot), as a single node, see Value::loss().
+ */
+template <typename T>
+BasicValue<T> softmax_cross_entropy(const std::vector<BasicValue<T>>& logits, const std::vector<T>& target) {
+    return BasicValue<T>::loss(Loss::CROSS_ENTROPY, logits, target);
+}
+
+/**
+ * @brief Same as above against Values, read again on every forward, see mse_loss().
+ */
+template <typename T>
+BasicValue<T> softmax_cross_entropy(const std::vector<BasicValue<T>>& logits, const std::vector<BasicValue<T>>& target) {
+    return BasicValue<T>::loss(Loss::CROSS_ENTROPY, logits, target);
+}
+
+/**
+ * @brief Softmax cross entropy over a [batch, n] tensor of logits, averaged over the batch, see Tensor::loss().
+ */
+template <typename T>
+BasicValue<T> softmax_cross_entropy(const BasicTensor<T>& logits, const T* target) {
+    return BasicTensor<T>::loss(Loss::CROSS_ENTROPY, logits, target);
+}
+
+/**
+ * @brief Same as above against a Tensor::input() of targets, read in place, see mse_loss().
+ */
+template <typename T>
+BasicValue<T> softmax_cross_entropy(const BasicTensor<T>& logits, const BasicTensor<T>& target) {
+    return BasicTensor<T>::loss(Loss::CROSS_ENTROPY, logits, target);
+}
 
-#endif  
+#endif
@@ -0,0 +1,269 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <cmath>
+#include "activation.h"
+
+/**
+    * @brief Expression templates: a scalar formula whose graph is its type.
+
+    * (var<0>() + var<1>()) * var<2>() + var<3>() builds no nodes at run time, it is a value of type
+    * ExprAdd<ExprMul<ExprAdd<ExprVar<0>, ExprVar<1>>, ExprVar<2>>, ExprVar<3>>, and nothing else.
+    * Evaluating it, or its gradient, is then a fully inlined straight-line function of the inputs:
+    * no Arena, no topological sort, no allocation, so it can sit in a hot loop,
+    * and without activations or pow it is constexpr as well.
+
+    * For ex.
+    * auto f = (var<0>() + var<1>()) * var<2>() + var<3>();
+    * float x[4] = {2.5, 3.7, -3.0, 1.7};
+    * float grad[4] = {};
+    * float y = f(x);                  // forward only
+    * float y = f.gradient(x, grad);   // forward and reverse mode, df/dx[i] is added to grad[i]
+
+    * The chain rule of every node is the one Value::backward() applies, the values of all nodes of a pass
+    * live in a local array of E::size scalars, laid out in post-order (children first, each subtree contiguous),
+    * which the compiler keeps in registers.
+    * Unlike a Value graph an expression is a tree: a subexpression used twice is computed twice.
+*/
+template <typename E> struct ExprAct;
+template <typename E> struct ExprPow;
+
+template <typename E>
+struct Expr {
+    constexpr const E& self() const { return static_cast<const E&>(*this); }
+
+    /**
+         * @brief Value of the expression.
+         * @param x the inputs, var<I>() reads x[I].
+    */
+    template <typename T>
+    constexpr T operator()(const T* x) const {
+        T v[E::size] = {};
+        self().eval(x, v);
+        return v[E::size - 1];
+    }
+
+    /**
+         * @brief Value of the expression, and its gradient wrt the inputs.
+         * @param x the inputs, var<I>() reads x[I].
+         * @param grad df/dx[I] is added to grad[I], like backward() adds to the grads of Values, so zero it first.
+         * @return The value (type: T).
+    */
+    template <typename T>
+    constexpr T gradient(const T* x, T* grad) const {
+        T v[E::size] = {};
+        self().eval(x, v);
+        self().back(v, T(1), grad);
+        return v[E::size - 1];
+    }
+
+    constexpr ExprAct<E> activate(Act act) const { return ExprAct<E>(act, self()); }
+    constexpr ExprAct<E> relu() const { return activate(Act::RELU); }
+    constexpr ExprAct<E> leaky_relu() const { return activate(Act::LEAKY_RELU); }
+    constexpr ExprAct<E> tanh() const { return activate(Act::TANH); }
+    constexpr ExprAct<E> sigmoid() const { return activate(Act::SIGMOID); }
+    constexpr ExprAct<E> gelu() const { return activate(Act::GELU); }
+    constexpr ExprPow<E> pow(double exponent) const { return ExprPow<E>(self(), exponent); }
+};
+
+/**
+     * @brief Input I of the expression, see var().
+*/
+template <int I>
+struct ExprVar : Expr<ExprVar<I>> {
+    static constexpr int size = 1;
+
+    template <typename T>
+    constexpr void eval(const T* x, T* v) const { v[0] = x[I]; }
+    template <typename T>
+    constexpr void back(const T*, T g, T* grad) const { grad[I] += g; }
+};
+
+template <int I>
+constexpr ExprVar<I> var() { return ExprVar<I>(); }
+
+/**
+     * @brief A plain number, like the constants of Value arithmetic. It gets no gradient.
+*/
+struct ExprConst : Expr<ExprConst> {
+    static constexpr int size = 1;
+    double value;
+
+    constexpr explicit ExprConst(double value) : value(value) {}
+    template <typename T>
+    constexpr void eval(const T*, T* v) const { v[0] = T(value); }
+    template <typename T>
+    constexpr void back(const T*, T, T*) const {}
+};
+
+/**
+     * @brief The binary nodes: l's values are at v[0, L::size), r's right after, the node's own value last.
+*/
+template <typename L, typename R>
+struct ExprAdd : Expr<ExprAdd<L, R>> {
+    static constexpr int size = L::size + R::size + 1;
+    L l;
+    R r;
+
+    constexpr ExprAdd(const L& l, const R& r) : l(l), r(r) {}
+    template <typename T>
+    constexpr void eval(const T* x, T* v) const {
+        l.eval(x, v);
+        r.eval(x, v + L::size);
+        v[size - 1] = v[L::size - 1] + v[size - 2];
+    }
+    template <typename T>
+    constexpr void back(const T* v, T g, T* grad) const {
+        l.back(v, g, grad);
+        r.back(v + L::size, g, grad);
+    }
+};
+
+template <typename L, typename R>
+struct ExprSub : Expr<ExprSub<L, R>> {
+    static constexpr int size = L::size + R::size + 1;
+    L l;
+    R r;
+
+    constexpr ExprSub(const L& l, const R& r) : l(l), r(r) {}
+    template <typename T>
+    constexpr void eval(const T* x, T* v) const {
+        l.eval(x, v);
+        r.eval(x, v + L::size);
+        v[size - 1] = v[L::size - 1] - v[size - 2];
+    }
+    template <typename T>
+    constexpr void back(const T* v, T g, T* grad) const {
+        l.back(v, g, grad);
+        r.back(v + L::size, -g, grad);
+    }
+};
+
+template <typename L, typename R>
+struct ExprMul : Expr<ExprMul<L, R>> {
+    static constexpr int size = L::size + R::size + 1;
+    L l;
+    R r;
+
+    constexpr ExprMul(const L& l, const R& r) : l(l), r(r) {}
+    template <typename T>
+    constexpr void eval(const T* x, T* v) const {
+        l.eval(x, v);
+        r.eval(x, v + L::size);
+        v[size - 1] = v[L::size - 1] * v[size - 2];
+    }
+    template <typename T>
+    constexpr void back(const T* v, T g, T* grad) const {
+        l.back(v, v[size - 2] * g, grad);
+        r.back(v + L::size, v[L::size - 1] * g, grad);
+    }
+};
+
+template <typename L, typename R>
+struct ExprDiv : Expr<ExprDiv<L, R>> {
+    static constexpr int size = L::size + R::size + 1;
+    L l;
+    R r;
+
+    constexpr ExprDiv(const L& l, const R& r) : l(l), r(r) {}
+    template <typename T>
+    constexpr void eval(const T* x, T* v) const {
+        l.eval(x, v);
+        r.eval(x, v + L::size);
+        v[size - 1] = v[L::size - 1] / v[size - 2];
+    }
+    template <typename T>
+    constexpr void back(const T* v, T g, T* grad) const {
+        // Same as Op::DIV: d(a/b)/db = -(a/b)/b.
+        l.back(v, g / v[size - 2], grad);
+        r.back(v + L::size, -(g * v[size - 1] / v[size - 2]), grad);
+    }
+};
+
+/**
+     * @brief The unary nodes: e's values first, the node's own value last.
+*/
+template <typename E>
+struct ExprNeg : Expr<ExprNeg<E>> {
+    static constexpr int size = E::size + 1;
+    E e;
+
+    constexpr explicit ExprNeg(const E& e) : e(e) {}
+    template <typename T>
+    constexpr void eval(const T* x, T* v) const {
+        e.eval(x, v);
+        v[size - 1] = -v[size - 2];
+    }
+    template <typename T>
+    constexpr void back(const T* v, T g, T* grad) const { e.back(v, -g, grad); }
+};
+
+template <typename E>
+struct ExprPow : Expr<ExprPow<E>> {
+    static constexpr int size = E::size + 1;
+    E e;
+    double exponent;
+
+    constexpr ExprPow(const E& e, double exponent) : e(e), exponent(exponent) {}
+    template <typename T>
+    void eval(const T* x, T* v) const {
+        e.eval(x, v);
+        v[size - 1] = std::pow(v[size - 2], T(exponent));
+    }
+    template <typename T>
+    void back(const T* v, T g, T* grad) const {
+        T b = T(exponent);
+        e.back(v, b * std::pow(v[size - 2], b - 1) * g, grad);
+    }
+};
+
+template <typename E>
+struct ExprAct : Expr<ExprAct<E>> {
+    static constexpr int size = E::size + 1;
+    Act act;
+    E e;
+
+    constexpr ExprAct(Act act, const E& e) : act(act), e(e) {}
+    template <typename T>
+    void eval(const T* x, T* v) const {
+        e.eval(x, v);
+        activate_forward(act, &v[size - 2], &v[size - 1], 1);
+    }
+    template <typename T>
+    void back(const T* v, T g, T* grad) const {
+        T dz = 0;
+        activate_backward(act, &v[size - 2], &v[size - 1], &g, &dz, 1);
+        e.back(v, dz, grad);
+    }
+};
+
+template <typename L, typename R>
+constexpr ExprAdd<L, R> operator+(const Expr<L>& l, const Expr<R>& r) { return ExprAdd<L, R>(l.self(), r.self()); }
+template <typename L, typename R>
+constexpr ExprSub<L, R> operator-(const Expr<L>& l, const Expr<R>& r) { return ExprSub<L, R>(l.self(), r.self()); }
+template <typename L, typename R>
+constexpr ExprMul<L, R> operator*(const Expr<L>& l, const Expr<R>& r) { return ExprMul<L, R>(l.self(), r.self()); }
+template <typename L, typename R>
+constexpr ExprDiv<L, R> operator/(const Expr<L>& l, const Expr<R>& r) { return ExprDiv<L, R>(l.self(), r.self()); }
+template <typename E>
+constexpr ExprNeg<E> operator-(const Expr<E>& e) { return ExprNeg<E>(e.self()); }
+
+// With a plain number on either side, the number is an ExprConst.
+template <typename L>
+constexpr ExprAdd<L, ExprConst> operator+(const Expr<L>& l, double r) { return l + ExprConst(r); }
+template <typename L>
+constexpr ExprSub<L, ExprConst> operator-(const Expr<L>& l, double r) { return l - ExprConst(r); }
+template <typename L>
+constexpr ExprMul<L, ExprConst> operator*(const Expr<L>& l, double r) { return l * ExprConst(r); }
+template <typename L>
+constexpr ExprDiv<L, ExprConst> operator/(const Expr<L>& l, double r) { return l / ExprConst(r); }
+template <typename R>
+constexpr ExprAdd<ExprConst, R> operator+(double l, const Expr<R>& r) { return ExprConst(l) + r; }
+template <typename R>
+constexpr ExprSub<ExprConst, R> operator-(double l, const Expr<R>& r) { return ExprConst(l) - r; }
+template <typename R>
+constexpr ExprMul<ExprConst, R> operator*(double l, const Expr<R>& r) { return ExprConst(l) * r; }
+template <typename R>
+constexpr ExprDiv<ExprConst, R> operator/(double l, const Expr<R>& r) { return ExprConst(l) / r; }
+
+#endif
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include "frozen.h"
+#include "gemm.h"
+
+/**
+    * @brief Number of weights and biases of a network with these layer sizes.
+*/
+static size_t weight_count(const std::vector<uint32_t>& sizes) {
+    size_t count = 0;
+    for (size_t l = 0; l + 1 < sizes.size(); ++l) {
+        count += size_t(sizes[l] + 1) * sizes[l + 1];
+    }
+    return count;
+}
+
+/**
+    * @brief Builds a frozen network out of its layer sizes, activations and weights.
+    * weights holds every layer one after the other, each as its weight matrix stored transposed,
+    * [nin, nout] row-major so row i is what input i adds to every output, followed by the nout biases.
+    * Throws std::invalid_argument if the sizes do not add up.
+*/
+FrozenMLP::FrozenMLP(std::vector<uint32_t> sizes, std::vector<Act> acts, std::vector<float> weights)
+    : sizes(std::move(sizes)), acts(std::move(acts)), weights(std::move(weights)) {
+    if (this->sizes.size() != this->acts.size() + 1) {
+        throw std::invalid_argument("FrozenMLP: expected one activation per layer");
+    }
+    if (this->weights.size() != weight_count(this->sizes)) {
+        throw std::invalid_argument("FrozenMLP: weights do not match the layer sizes");
+    }
+}
+
+/**
+    * @brief Takes its layer sizes and activations from a mapped checkpoint, and its weights stay there.
+*/
+FrozenMLP::FrozenMLP(std::shared_ptr<const Checkpoint> checkpoint)
+    : sizes(checkpoint->sizes(), checkpoint->sizes() + checkpoint->layers() + 1), checkpoint(checkpoint) {
+    for (uint32_t l = 0; l < checkpoint->layers(); ++l) {
+        acts.push_back(checkpoint->act(l));
+    }
+    if (acts.empty() || checkpoint->weights_size() != weight_count(sizes)) {
+        throw std::runtime_error("FrozenMLP: the checkpoint's weights do not match its layer sizes");
+    }
+}
+
+/**
+    * @brief Serves a model straight out of a checkpoint file (see checkpoint.cpp), with zero copies.
+    * The file is mapped and its weights are used in place, so loading takes the same time whatever the size of the model,
+    * and the pages are only read from disk once forward() touches them. The mapping is shared by the copies of the FrozenMLP.
+    * Throws std::runtime_error if the file is not a valid checkpoint.
+*/
+FrozenMLP FrozenMLP::load(const std::string& path) {
+    return FrozenMLP(std::make_shared<const Checkpoint>(path));
+}
+
+/**
+    * @brief Writes the model to a checkpoint file, with the optimizer state if one is given (see MLP::save()).
+*/
+void FrozenMLP::save(const std::string& path, const float* state, uint64_t n_state) const {
+    Checkpoint::write(path, sizes, acts, weight_data(), checkpoint ? checkpoint->weights_size() : weights.size(), state, n_state);
+}
+
+/**
+    * @brief Runs the network on a row-major [batch, nin] matrix and writes the [batch, nout] outputs to out.
+    * Every layer is its biases broadcast over the rows, one gemm() against the transposed weights,
+    * and the activation in place. A single example instead goes through axpy(): one pass over a contiguous row of
+    * the transposed weights per input, which vectorizes across the outputs and needs no packing.
+    * The activations in between go to two buffers per thread, reused across calls,
+    * so this is safe to call from several threads at once and does not allocate once they have grown.
+*/
+void FrozenMLP::forward(const float* x, uint32_t batch, float* out) const {
+    thread_local std::vector<float> buffers[2];
+    const float* in = x;
+    const float* w = weight_data();
+    for (size_t l = 0; l < acts.size(); ++l) {
+        uint32_t nin = sizes[l];
+        uint32_t nout = sizes[l + 1];
+        const float* bias = w + nin * nout;
+
+        float* dst = out;
+        if (l + 1 != acts.size()) {
+            std::vector<float>& buffer = buffers[l % 2];
+            if (buffer.size() < batch * nout) {
+                buffer.resize(batch * nout);
+            }
+            dst = buffer.data();
+        }
+
+        for (uint32_t b = 0; b < batch; ++b) {
+            std::copy(bias, bias + nout, dst + b * nout);
+        }
+        if (batch == 1) {
+            for (uint32_t i = 0; i < nin; ++i) {
+                axpy(nout, in[i], w + i * nout, dst);
+            }
+        } else {
+            gemm(false, false, batch, nout, nin, in, nin, w, nout, dst, nout);
+        }
+        activate_forward(acts[l], dst, dst, batch * nout);
+
+        in = dst;
+        w = bias + nout;
+    }
+}
+
+/**
+    * @brief Same as above, for ex. `auto y = model.forward({0, 1});` for a single example.
+*/
+std::vector<float> FrozenMLP::forward(const std::vector<float>& x, uint32_t batch) const {
+    std::vector<float> out(batch * nout());
+    forward(x.data(), batch, out.data());
+    return out;
+}
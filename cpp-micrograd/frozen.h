@@ -0,0 +1,40 @@
+#ifndef FROZEN_H
+#define FROZEN_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "activation.h"
+#include "checkpoint.h"
+
+/**
+    * @brief A trained MLP, frozen for inference: plain weight matrices and a forward pass, nothing else.
+    * It has no Value, no graph and no gradients, and does not depend on engine or nn,
+    * so it can be shipped with just frozen.cpp, checkpoint.cpp, activation.cpp and gemm.cpp.
+    * Get one from MLP::freeze(), or from a checkpoint file with FrozenMLP::load().
+*/
+class FrozenMLP {
+private:
+    std::vector<uint32_t> sizes;  // nin, then the nout of every layer
+    std::vector<Act> acts;        // the activation of every layer
+    std::vector<float> weights;   // every layer in order: its [nin, nout] transposed weights, then its nout biases
+    std::shared_ptr<const Checkpoint> checkpoint;  // when loaded, the weights are read from its mapping instead
+
+    explicit FrozenMLP(std::shared_ptr<const Checkpoint> checkpoint);
+    const float* weight_data() const { return checkpoint ? checkpoint->weights() : weights.data(); }
+
+public:
+    FrozenMLP(std::vector<uint32_t> sizes, std::vector<Act> acts, std::vector<float> weights);
+    static FrozenMLP load(const std::string& path);
+    void save(const std::string& path, const float* state = nullptr, uint64_t n_state = 0) const;
+
+    uint32_t nin() const { return sizes.front(); }
+    uint32_t nout() const { return sizes.back(); }
+    uint32_t layers() const { return static_cast<uint32_t>(acts.size()); }
+
+    void forward(const float* x, uint32_t batch, float* out) const;
+    std::vector<float> forward(const std::vector<float>& x, uint32_t batch = 1) const;
+};
+
+#endif
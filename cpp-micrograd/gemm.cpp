@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <vector>
+#include "gemm.h"
+
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+#include <immintrin.h>
+#endif
+
+/**
+    * @brief A cache-blocked matrix multiply, the workhorse behind tensor-valued Layers.
+
+    * The loops follow the usual GotoBLAS structure:
+    * the k dimension is cut into KC wide slabs and n into NC wide ones, so a packed slab of B stays in L2/L3,
+    * m is cut into MC tall blocks, so a packed block of A stays in L1/L2,
+    * and a MR x NR micro-kernel keeps its whole tile of C in registers while it runs over the packed k.
+    * Packing also takes care of transposes and leading dimensions, the micro-kernel only ever sees contiguous panels.
+
+    * Which micro-kernel is compiled depends on the target:
+    * AVX-512 (6x32, two zmm per row), AVX2+FMA (6x16, two ymm per row), or a portable scalar one (4x8) that the compiler may still auto-vectorize.
+    * Build with `-O3 -march=native` to get the vector ones.
+    * Double precision uses the same blocking with the portable micro-kernel.
+*/
+
+#if defined(__AVX512F__)
+static const int MR = 6;
+static const int NR = 32;
+#elif defined(__AVX2__) && defined(__FMA__)
+static const int MR = 6;
+static const int NR = 16;
+#else
+static const int MR = 4;
+static const int NR = 8;
+#endif
+
+static const int MC = 120;
+static const int KC = 256;
+static const int NC = 2048;
+
+/**
+     * @brief Copies the mc x kc block of op(A) starting at (i0, k0) into MR tall panels, zero padding the last one.
+     * Inside a panel the MR values of one k are next to each other, which is the order the micro-kernel reads them in.
+*/
+template <typename T>
+static void pack_a(bool trans, const T* a, int lda, int i0, int k0, int mc, int kc, T* dst) {
+    for (int ip = 0; ip < mc; ip += MR) {
+        for (int p = 0; p < kc; ++p) {
+            for (int r = 0; r < MR; ++r) {
+                int i = i0 + ip + r;
+                int kk = k0 + p;
+                T v = 0.0;
+                if (ip + r < mc) {
+                    v = trans ? a[kk * lda + i] : a[i * lda + kk];
+                }
+                *dst++ = v;
+            }
+        }
+    }
+}
+
+/**
+     * @brief Copies the kc x nc block of op(B) starting at (k0, j0) into NR wide panels, zero padding the last one.
+*/
+template <typename T>
+static void pack_b(bool trans, const T* b, int ldb, int k0, int j0, int kc, int nc, T* dst) {
+    for (int jp = 0; jp < nc; jp += NR) {
+        for (int p = 0; p < kc; ++p) {
+            for (int c = 0; c < NR; ++c) {
+                int j = j0 + jp + c;
+                int kk = k0 + p;
+                T v = 0.0;
+                if (jp + c < nc) {
+                    v = trans ? b[j * ldb + kk] : b[kk * ldb + j];
+                }
+                *dst++ = v;
+            }
+        }
+    }
+}
+
+/**
+     * @brief Adds an MR x NR tile to C, only the top-left m x n of it are inside the matrix.
+*/
+template <typename T>
+static void add_tile(const T* tile, T* c, int ldc, int m, int n) {
+    for (int r = 0; r < m; ++r) {
+        for (int col = 0; col < n; ++col) {
+            c[r * ldc + col] += tile[r * NR + col];
+        }
+    }
+}
+
+/**
+     * @brief The portable micro-kernel, the vector ones below take over for float when they are compiled in.
+*/
+template <typename T>
+static void micro_kernel(int kc, const T* a, const T* b, T* c, int ldc, int m, int n) {
+    T tile[MR * NR] = {0};
+    for (int p = 0; p < kc; ++p) {
+        for (int r = 0; r < MR; ++r) {
+            T av = a[p * MR + r];
+            for (int col = 0; col < NR; ++col) {
+                tile[r * NR + col] += av * b[p * NR + col];
+            }
+        }
+    }
+    add_tile(tile, c, ldc, m, n);
+}
+
+#if defined(__AVX512F__)
+
+static void micro_kernel(int kc, const float* a, const float* b, float* c, int ldc, int m, int n) {
+    __m512 acc[MR][2];
+    for (int r = 0; r < MR; ++r) {
+        acc[r][0] = _mm512_setzero_ps();
+        acc[r][1] = _mm512_setzero_ps();
+    }
+    for (int p = 0; p < kc; ++p) {
+        __m512 b0 = _mm512_loadu_ps(b + p * NR);
+        __m512 b1 = _mm512_loadu_ps(b + p * NR + 16);
+        for (int r = 0; r < MR; ++r) {
+            __m512 av = _mm512_set1_ps(a[p * MR + r]);
+            acc[r][0] = _mm512_fmadd_ps(av, b0, acc[r][0]);
+            acc[r][1] = _mm512_fmadd_ps(av, b1, acc[r][1]);
+        }
+    }
+    if (m == MR && n == NR) {
+        for (int r = 0; r < MR; ++r) {
+            float* row = c + r * ldc;
+            _mm512_storeu_ps(row, _mm512_add_ps(_mm512_loadu_ps(row), acc[r][0]));
+            _mm512_storeu_ps(row + 16, _mm512_add_ps(_mm512_loadu_ps(row + 16), acc[r][1]));
+        }
+        return;
+    }
+    float tile[MR * NR];
+    for (int r = 0; r < MR; ++r) {
+        _mm512_storeu_ps(tile + r * NR, acc[r][0]);
+        _mm512_storeu_ps(tile + r * NR + 16, acc[r][1]);
+    }
+    add_tile(tile, c, ldc, m, n);
+}
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+static void micro_kernel(int kc, const float* a, const float* b, float* c, int ldc, int m, int n) {
+    __m256 acc[MR][2];
+    for (int r = 0; r < MR; ++r) {
+        acc[r][0] = _mm256_setzero_ps();
+        acc[r][1] = _mm256_setzero_ps();
+    }
+    for (int p = 0; p < kc; ++p) {
+        __m256 b0 = _mm256_loadu_ps(b + p * NR);
+        __m256 b1 = _mm256_loadu_ps(b + p * NR + 8);
+        for (int r = 0; r < MR; ++r) {
+            __m256 av = _mm256_broadcast_ss(a + p * MR + r);
+            acc[r][0] = _mm256_fmadd_ps(av, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(av, b1, acc[r][1]);
+        }
+    }
+    if (m == MR && n == NR) {
+        for (int r = 0; r < MR; ++r) {
+            float* row = c + r * ldc;
+            _mm256_storeu_ps(row, _mm256_add_ps(_mm256_loadu_ps(row), acc[r][0]));
+            _mm256_storeu_ps(row + 8, _mm256_add_ps(_mm256_loadu_ps(row + 8), acc[r][1]));
+        }
+        return;
+    }
+    float tile[MR * NR];
+    for (int r = 0; r < MR; ++r) {
+        _mm256_storeu_ps(tile + r * NR, acc[r][0]);
+        _mm256_storeu_ps(tile + r * NR + 8, acc[r][1]);
+    }
+    add_tile(tile, c, ldc, m, n);
+}
+
+#endif
+
+/**
+     * @brief C += op(A) * op(B), all matrices row-major.
+     * op(A) is m x k, op(B) is k x n and C is m x n.
+     * With trans_a, A is stored as k x m and op(A) is its transpose, likewise for trans_b.
+     * The leading dimensions are the distance between two rows as stored, so sub-matrices and strided views work as well.
+     * For ex. C = X * W^T for a [batch, nin] X and a [nout, nin] W:
+     * gemm(false, true, batch, nout, nin, X, nin, W, nin, C, nout);
+
+     * @param trans_a Use the transpose of A.
+     * @param trans_b Use the transpose of B.
+     * @param m Rows of op(A) and C.
+     * @param n Columns of op(B) and C.
+     * @param k Columns of op(A), rows of op(B).
+     * @param a, lda A and its leading dimension.
+     * @param b, ldb B and its leading dimension.
+     * @param c, ldc C and its leading dimension, accumulated into.
+*/
+template <typename T>
+static void blocked_gemm(bool trans_a, bool trans_b, int m, int n, int k,
+                         const T* a, int lda, const T* b, int ldb, T* c, int ldc) {
+    if (m <= 0 || n <= 0 || k <= 0) {
+        return;
+    }
+
+    // Packing buffers are reused across calls, and per thread so concurrent callers do not share them.
+    thread_local std::vector<T> packed_a;
+    thread_local std::vector<T> packed_b;
+    packed_a.resize((MC + MR) * KC);
+    packed_b.resize((NC + NR) * KC);
+
+    for (int jc = 0; jc < n; jc += NC) {
+        int nc = std::min(NC, n - jc);
+        for (int pc = 0; pc < k; pc += KC) {
+            int kc = std::min(KC, k - pc);
+            pack_b(trans_b, b, ldb, pc, jc, kc, nc, packed_b.data());
+
+            for (int ic = 0; ic < m; ic += MC) {
+                int mc = std::min(MC, m - ic);
+                pack_a(trans_a, a, lda, ic, pc, mc, kc, packed_a.data());
+
+                for (int jr = 0; jr < nc; jr += NR) {
+                    for (int ir = 0; ir < mc; ir += MR) {
+                        micro_kernel(kc, packed_a.data() + ir * kc, packed_b.data() + jr * kc,
+                                     c + (ic + ir) * ldc + jc + jr, ldc,
+                                     std::min(MR, mc - ir), std::min(NR, nc - jr));
+                    }
+                }
+            }
+        }
+    }
+}
+
+void gemm(bool trans_a, bool trans_b, int m, int n, int k,
+          const float* a, int lda, const float* b, int ldb, float* c, int ldc) {
+    blocked_gemm(trans_a, trans_b, m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+void gemm(bool trans_a, bool trans_b, int m, int n, int k,
+          const double* a, int lda, const double* b, int ldb, double* c, int ldc) {
+    blocked_gemm(trans_a, trans_b, m, n, k, a, lda, b, ldb, c, ldc);
+}
+
+/**
+     * @brief y += alpha * x, for n floats.
+     * For ex. an SGD step over all parameters of a model: axpy(params.size(), -lr, params.grad(), params.data());
+     * x and y must not overlap, which lets the compiler vectorize the loop.
+*/
+void axpy(int n, float alpha, const float* __restrict x, float* __restrict y) {
+    for (int i = 0; i < n; ++i) {
+        y[i] += alpha * x[i];
+    }
+}
+
+void axpy(int n, double alpha, const double* __restrict x, double* __restrict y) {
+    for (int i = 0; i < n; ++i) {
+        y[i] += alpha * x[i];
+    }
+}
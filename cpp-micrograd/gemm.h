@@ -0,0 +1,12 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+void gemm(bool trans_a, bool trans_b, int m, int n, int k,
+          const float* a, int lda, const float* b, int ldb, float* c, int ldc);
+void gemm(bool trans_a, bool trans_b, int m, int n, int k,
+          const double* a, int lda, const double* b, int ldb, double* c, int ldc);
+
+void axpy(int n, float alpha, const float* x, float* y);
+void axpy(int n, double alpha, const double* x, double* y);
+
+#endif
@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <tuple>
+#include <vector>
+#include "graph_opt.h"
+
+static const uint32_t NONE = UINT32_MAX;
+static const uint32_t MANY = UINT32_MAX - 1;
+
+// Ops whose data is a function of their children's data alone, they can be folded into a constant.
+static bool is_foldable(Op op) {
+    switch (op) {
+        case Op::ADD: case Op::MUL: case Op::POW: case Op::SUB: case Op::DIV: case Op::NEG:
+        case Op::ACT: case Op::DOT: case Op::MEAN: case Op::LOSS:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Scalar ops of at most two children, that an Op::FUSED node can run.
+static bool is_elementwise(Op op) {
+    switch (op) {
+        case Op::ADD: case Op::MUL: case Op::POW: case Op::SUB: case Op::DIV: case Op::NEG: case Op::ACT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+template <typename T>
+static bool is_constant(BasicArena<T>& arena, uint32_t id) {
+    return !(id & PARAM_BIT) && arena[id].op == Op::LEAF && arena[id].custom == CONSTANT_LEAF;
+}
+
+template <typename T>
+static uint64_t bits_of(T value) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(T));
+    return bits;
+}
+
+/**
+     * @brief Turns every node whose children are all constants into a constant itself, its data is already the folded value.
+     * @return The number of nodes folded.
+*/
+template <typename T>
+static uint32_t fold_constants(BasicArena<T>& arena, uint32_t root) {
+    uint32_t folded = 0;
+    for (uint32_t id: arena.topo_sort(root)) {
+        BasicNode<T>& node = arena[id];
+        if (!is_foldable(node.op)) {
+            continue;
+        }
+        uint32_t count;
+        const uint32_t* prev = arena.children(node, count);
+        bool constant = count > 0;
+        for (uint32_t i = 0; i < count && constant; ++i) {
+            constant = is_constant(arena, prev[i]);
+        }
+        // The Value targets of a loss are read on every forward too, they are not among its children.
+        for (uint32_t i = 0; node.op == Op::LOSS && i < count && constant; ++i) {
+            uint32_t target = prev[count + i];
+            constant = target == NO_TARGET || is_constant(arena, target);
+        }
+        if (constant) {
+            node.op = Op::LEAF;
+            node.n_prev = 0;
+            node.prev[0] = node.prev[1] = 0;
+            node.custom = CONSTANT_LEAF;
+            ++folded;
+        }
+    }
+    return folded;
+}
+
+/**
+     * @brief Points every use of a constant to the first constant of the graph with the same bits.
+     * Arena::constant() already interns most of them, this catches what its cache missed and what folding produced.
+     * @return The number of constants that are no longer used.
+*/
+template <typename T>
+static uint32_t merge_constants(BasicArena<T>& arena, uint32_t root) {
+    std::map<uint64_t, uint32_t> first;
+    uint32_t merged = 0;
+    for (uint32_t id: arena.topo_sort(root)) {
+        if (is_constant(arena, id) && !first.emplace(bits_of(arena[id].data), id).second) {
+            ++merged;
+        }
+    }
+    if (merged == 0) {
+        return 0;
+    }
+    for (uint32_t id: arena.topo_sort(root)) {
+        uint32_t count;
+        uint32_t* prev = arena.children(arena[id], count);
+        for (uint32_t i = 0; i < count; ++i) {
+            if (is_constant(arena, prev[i])) {
+                prev[i] = first[bits_of(arena[prev[i]].data)];
+            }
+        }
+    }
+    return merged;
+}
+
+/**
+     * @brief Fuses trees of elementwise nodes into single Op::FUSED nodes.
+
+     * A region is grown from a node down through children that are elementwise and have no other consumer.
+     * Its nodes run as a list of instructions inside the fused node, see Arena::forward(), and their grads stay internal.
+     * Equal instructions (same op on the same registers) are computed once, but each keeps its own grad.
+
+     * Backward adds the contributions of a region's nodes to an input x all at once, at the place of the region's root.
+     * Float additions do not commute, so a region is only fused when nothing else adds to x between the first of its nodes
+     * that uses x and its root, i.e. when the sums come out in the same order as without fusing.
+     * The inputs of a fused node are listed in the order the nodes they replace reached them,
+     * so a topological sort of the new graph visits everything else in the same order as before.
+
+     * @param fused set to the number of fused nodes made.
+     * @param shared set to the number of instructions computed once instead of twice.
+*/
+template <typename T>
+static void fuse_elementwise(BasicArena<T>& arena, uint32_t root, uint32_t& fused, uint32_t& shared) {
+    std::vector<uint32_t> order = arena.topo_sort(root);
+    uint32_t n = static_cast<uint32_t>(order.size());
+    std::vector<uint32_t> pos(arena.size(), NONE);
+    for (uint32_t i = 0; i < n; ++i) {
+        pos[order[i]] = i;
+    }
+
+    // Who reads what: the only consumer of every node (or MANY), every (input, reader) pair,
+    // and the parameter blocks Op::LINEAR nodes write to without listing them as children.
+    std::vector<uint32_t> consumer(n, NONE);
+    std::vector<std::pair<uint32_t, uint32_t>> reads;
+    std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> blocks;
+    for (uint32_t i = 0; i < n; ++i) {
+        BasicNode<T>& node = arena[order[i]];
+        uint32_t count;
+        const uint32_t* prev = arena.children(node, count);
+        for (uint32_t k = 0; k < count; ++k) {
+            reads.push_back({prev[k], i});
+            if (!(prev[k] & PARAM_BIT)) {
+                uint32_t& c = consumer[pos[prev[k]]];
+                c = c == NONE || c == i ? i : MANY;
+            }
+        }
+        if (node.op == Op::LINEAR) {
+            const uint32_t* info = arena.operands_at(node.prev[0]);
+            blocks.emplace_back(i, info[4], info[1] * (info[3] + 1));
+        }
+    }
+    consumer[n - 1] = MANY;
+    std::sort(reads.begin(), reads.end());
+
+    std::vector<uint32_t> mark(n, NONE);
+    std::vector<char> absorbed(n, 0);
+    std::vector<uint32_t> members, inputs, lowest;
+    std::vector<std::pair<uint32_t, uint32_t>> stack;
+    std::map<uint32_t, uint32_t> input_of;
+
+    for (uint32_t r = n; r-- > 0;) {
+        if (absorbed[r] || !is_elementwise(arena[order[r]].op)) {
+            continue;
+        }
+
+        // Walk the region depth first, children in order, like topo_sort() does, noting the inputs as they come.
+        members.clear();
+        inputs.clear();
+        lowest.clear();
+        input_of.clear();
+        stack.clear();
+        mark[r] = r;
+        stack.push_back({r, 0});
+        while (!stack.empty()) {
+            uint32_t p = stack.back().first;
+            uint32_t k = stack.back().second++;
+            const BasicNode<T>& node = arena[order[p]];
+            if (k == node.n_prev) {
+                members.push_back(p);
+                stack.pop_back();
+                continue;
+            }
+            uint32_t child = node.prev[k];
+            if (!(child & PARAM_BIT)) {
+                uint32_t q = pos[child];
+                if (mark[q] == r) {
+                    continue;
+                }
+                if (consumer[q] == p && is_elementwise(arena[child].op)) {
+                    mark[q] = r;
+                    stack.push_back({q, 0});
+                    continue;
+                }
+            }
+            auto it = input_of.emplace(child, static_cast<uint32_t>(inputs.size())).first;
+            if (it->second == inputs.size()) {
+                inputs.push_back(child);
+                lowest.push_back(p);
+            }
+            lowest[it->second] = std::min(lowest[it->second], p);
+        }
+        if (members.size() < 2) {
+            continue;
+        }
+
+        // The order check, for every input: nothing outside the region reads it strictly between lowest and r.
+        bool exact = true;
+        for (uint32_t i = 0; i < inputs.size() && exact; ++i) {
+            auto it = std::upper_bound(reads.begin(), reads.end(), std::make_pair(inputs[i], lowest[i]));
+            for (; it != reads.end() && it->first == inputs[i] && it->second < r && exact; ++it) {
+                exact = mark[it->second] == r;
+            }
+            if (inputs[i] & PARAM_BIT) {
+                uint32_t param = inputs[i] & ~PARAM_BIT;
+                for (const auto& block: blocks) {
+                    uint32_t at = std::get<0>(block);
+                    if (at > lowest[i] && at < r && param >= std::get<1>(block) && param - std::get<1>(block) < std::get<2>(block)) {
+                        exact = false;
+                    }
+                }
+            }
+        }
+        if (!exact) {
+            for (uint32_t p: members) {
+                mark[p] = NONE;
+            }
+            continue;
+        }
+
+        // Registers: the inputs, then the members in graph order, so every instruction only reads earlier ones.
+        std::sort(members.begin(), members.end());
+        uint32_t n_in = static_cast<uint32_t>(inputs.size());
+        uint32_t n_ops = static_cast<uint32_t>(members.size());
+        uint32_t offset = arena.push_operands(1 + n_in + 4 * n_ops);
+        uint32_t* info = arena.operands_at(offset);
+        T* reg = arena.operand_data_at(offset) + 1;
+        info[0] = n_ops;
+        for (uint32_t i = 0; i < n_in; ++i) {
+            info[1 + i] = inputs[i];
+            reg[i] = BasicValue<T>::data_ref(inputs[i]);
+        }
+
+        std::map<std::tuple<uint32_t, uint32_t, uint32_t>, uint32_t> seen;
+        std::vector<uint32_t> canonical(n_in + n_ops);
+        for (uint32_t i = 0; i < n_in; ++i) {
+            canonical[i] = i;
+        }
+        uint32_t* code = info + 1 + n_in;
+        for (uint32_t k = 0; k < n_ops; ++k, code += 4) {
+            const BasicNode<T>& node = arena[order[members[k]]];
+            uint32_t operand[2] = {0, 0};
+            for (uint32_t j = 0; j < node.n_prev; ++j) {
+                uint32_t child = node.prev[j];
+                bool member = !(child & PARAM_BIT) && mark[pos[child]] == r;
+                operand[j] = member ? n_in + static_cast<uint32_t>(std::lower_bound(members.begin(), members.end(), pos[child]) - members.begin())
+                                    : input_of[child];
+            }
+            if (node.n_prev == 1) {
+                operand[1] = operand[0];
+            }
+            code[0] = static_cast<uint32_t>(node.op) | (node.op == Op::ACT ? static_cast<uint32_t>(node.custom) << 8 : 0);
+            code[1] = operand[0];
+            code[2] = operand[1];
+            code[3] = NONE;
+            reg[n_in + k] = node.data;
+
+            uint32_t a = canonical[operand[0]], b = canonical[operand[1]];
+            if ((node.op == Op::ADD || node.op == Op::MUL) && b < a) {
+                std::swap(a, b);
+            }
+            auto it = seen.emplace(std::make_tuple(code[0], a, b), n_in + k);
+            if (it.second) {
+                canonical[n_in + k] = n_in + k;
+            } else {
+                canonical[n_in + k] = it.first->second;
+                code[3] = it.first->second;
+                ++shared;
+            }
+        }
+
+        BasicNode<T>& node = arena[order[r]];
+        node.op = Op::FUSED;
+        node.prev[0] = offset;
+        node.prev[1] = n_in;
+        node.n_prev = 0;
+        node.custom = 0;
+        for (uint32_t p: members) {
+            absorbed[p] = 1;
+        }
+        ++fused;
+    }
+}
+
+/**
+    * @brief Rewrites the graph below root in place, to less nodes that compute the same thing.
+
+    * Three passes, in this order:
+    * - constant folding: nodes that only depend on constants (Value::constant(), the scalars of x * 2 and such) become constants,
+    * - constant deduplication: equal constants are merged into one node,
+    * - elementwise fusion: trees of +, -, *, /, pow and activations become single Op::FUSED nodes, see fuse_elementwise().
+
+    * The data of the root and the data and grads of the leaves and parameters are exactly, bit for bit, what they are without the pass.
+    * Nodes that were folded or fused away are no longer updated, so only read the root and the leaves afterwards.
+    * Common subexpressions are only shared inside a fused node: merging two equal nodes in general would sum their grads
+    * before passing them on, which changes the rounding of the leaves' grads.
+
+    * Call it once the graph is built, and before Value::backward() or building a Tape, which then replays the smaller graph.
+    * For ex.
+    * Value loss = ...;
+    * GraphStats stats = optimize_graph(loss);   // stats.removed() nodes less
+    * Tape tape(loss);
+
+    * @param root the output of the graph, an arena node.
+    * @return What was done (type: GraphStats).
+*/
+template <typename T>
+GraphStats optimize_graph(const BasicValue<T>& root) {
+    BasicArena<T>& arena = BasicArena<T>::current();
+    GraphStats stats = {};
+    if (root.is_parameter()) {
+        return stats;
+    }
+    uint32_t id = root.get_id();
+    stats.nodes_before = static_cast<uint32_t>(arena.topo_sort(id).size());
+    stats.folded = fold_constants(arena, id);
+    stats.deduplicated = merge_constants(arena, id);
+    fuse_elementwise(arena, id, stats.fused, stats.deduplicated);
+    stats.nodes_after = static_cast<uint32_t>(arena.topo_sort(id).size());
+    return stats;
+}
+
+template GraphStats optimize_graph(const BasicValue<float>& root);
+template GraphStats optimize_graph(const BasicValue<double>& root);
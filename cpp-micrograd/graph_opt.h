@@ -0,0 +1,23 @@
+#ifndef GRAPH_OPT_H
+#define GRAPH_OPT_H
+
+#include <cstdint>
+#include "engine.h"
+
+/**
+    * @brief What optimize_graph() did to a graph.
+*/
+struct GraphStats {
+    uint32_t nodes_before;  // nodes reachable from the root before the pass
+    uint32_t nodes_after;   // and after it
+    uint32_t folded;        // nodes that only depended on constants and became constants themselves
+    uint32_t deduplicated;  // constants merged into an equal one, and values computed once inside a fused node instead of twice
+    uint32_t fused;         // Op::FUSED nodes made out of chains of elementwise nodes
+
+    uint32_t removed() const { return nodes_before - nodes_after; }
+};
+
+template <typename T>
+GraphStats optimize_graph(const BasicValue<T>& root);
+
+#endif
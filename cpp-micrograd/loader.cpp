@@ -0,0 +1,126 @@
+#include "loader.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+/**
+     * @brief Adds item at the tail, false if the queue is full.
+     * The release store publishes the item, and whatever the producer wrote before it, to the consumer.
+*/
+bool SpscQueue::push(uint32_t item) {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    uint32_t next = (t + 1) % items.size();
+    if (next == head.load(std::memory_order_acquire)) {
+        return false;
+    }
+    items[t] = item;
+    tail.store(next, std::memory_order_release);
+    return true;
+}
+
+/**
+     * @brief Takes the item at the head, false if the queue is empty.
+*/
+bool SpscQueue::pop(uint32_t& item) {
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+        return false;
+    }
+    item = items[h];
+    head.store((h + 1) % items.size(), std::memory_order_release);
+    return true;
+}
+
+/**
+    * @brief BatchLoader prepares minibatches on a background thread, ahead of the training loop.
+
+    * The dataset is `size` examples, with row-major [size, nin] inputs x and [size, nout] targets y, and is not copied.
+    * Every epoch the producer thread shuffles the order of the examples, and gathers them batch_size at a time
+    * into one of prefetch + 1 preallocated slots, which go round between the two threads through two lock-free queues:
+    * ready ones to the trainer, used ones back to the producer. So there is no allocation and no lock while training,
+    * and as long as preparing a batch is faster than a training step, next() never waits.
+    * The last batch of an epoch holds the rest of the examples, so it can have fewer than batch_size rows.
+
+    * For ex.
+    * BatchLoader loader(x.data(), y.data(), n, nin, nout, 32, epochs);
+    * while (const Batch* batch = loader.next()) {
+    *     trainer.step(batch->x, nin, batch->y, nout, batch->rows);
+    * }
+
+    * @param batch_size Rows per batch, at least one: throws std::invalid_argument otherwise.
+    * @param epochs Passes over the dataset, 0 to go on until the loader is destroyed.
+    * @param seed Seed of the shuffles, a fixed one makes them reproducible.
+    * @param prefetch How many batches may be ready and waiting at once.
+*/
+BatchLoader::BatchLoader(const float* x, const float* y, uint32_t size, uint32_t nin, uint32_t nout, uint32_t batch_size,
+                         uint32_t epochs, uint32_t seed, uint32_t prefetch)
+    : x(x), y(y), size(size), nin(nin), nout(nout), batch_size(batch_size), epochs(epochs), gen(seed),
+      slots(prefetch + 1, std::vector<float>(batch_size * (nin + nout))), batches(prefetch + 1),
+      ready(prefetch + 2), recycled(prefetch + 1), current(UINT32_MAX), finished(false), stopping(false) {
+    if (batch_size == 0) {
+        throw std::invalid_argument("BatchLoader: batch_size must be at least 1");
+    }
+    for (uint32_t slot = 0; slot <= prefetch; ++slot) {
+        recycled.push(slot);
+    }
+    producer = std::thread(&BatchLoader::produce, this);
+}
+
+BatchLoader::~BatchLoader() {
+    stopping.store(true, std::memory_order_relaxed);
+    producer.join();
+}
+
+void BatchLoader::produce() {
+    std::vector<uint32_t> order(size);
+    std::iota(order.begin(), order.end(), 0);
+    for (uint32_t epoch = 0; size > 0 && (epochs == 0 || epoch < epochs); ++epoch) {
+        std::shuffle(order.begin(), order.end(), gen);
+        for (uint32_t start = 0; start < size; start += batch_size) {
+            uint32_t slot;
+            while (!recycled.pop(slot)) {
+                if (stopping.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                std::this_thread::yield();
+            }
+
+            uint32_t rows = std::min(batch_size, size - start);
+            float* bx = slots[slot].data();
+            float* by = bx + batch_size * nin;
+            for (uint32_t r = 0; r < rows; ++r) {
+                std::memcpy(bx + r * nin, x + static_cast<size_t>(order[start + r]) * nin, nin * sizeof(float));
+                std::memcpy(by + r * nout, y + static_cast<size_t>(order[start + r]) * nout, nout * sizeof(float));
+            }
+            batches[slot] = {bx, by, rows, epoch};
+            ready.push(slot);
+        }
+    }
+    // No more batches. ready has room for every slot plus this.
+    ready.push(UINT32_MAX);
+}
+
+/**
+     * @brief The next minibatch, or nullptr once all epochs are done.
+     * The batch stays valid until the following call to next(), which hands its slot back to the producer.
+*/
+const Batch* BatchLoader::next() {
+    if (current != UINT32_MAX) {
+        recycled.push(current);
+        current = UINT32_MAX;
+    }
+    if (finished) {
+        return nullptr;
+    }
+    uint32_t slot;
+    while (!ready.pop(slot)) {
+        std::this_thread::yield();
+    }
+    if (slot == UINT32_MAX) {
+        finished = true;
+        return nullptr;
+    }
+    current = slot;
+    return &batches[slot];
+}
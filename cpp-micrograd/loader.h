@@ -0,0 +1,67 @@
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <atomic>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+/**
+    * @brief A bounded single-producer single-consumer queue of uint32_t, without locks.
+    * One thread may push() and one other thread may pop(), both return false instead of blocking.
+*/
+class SpscQueue {
+    private:
+        std::vector<uint32_t> items;
+        alignas(64) std::atomic<uint32_t> head;  // next item to pop, written by the consumer only
+        alignas(64) std::atomic<uint32_t> tail;  // next free place, written by the producer only
+
+    public:
+        explicit SpscQueue(uint32_t capacity) : items(capacity + 1), head(0), tail(0) {}
+
+        bool push(uint32_t item);
+        bool pop(uint32_t& item);
+};
+
+struct Batch {
+    const float* x;  // [rows, nin] inputs
+    const float* y;  // [rows, nout] targets
+    uint32_t rows;
+    uint32_t epoch;
+};
+
+class BatchLoader {
+    private:
+        const float* x;
+        const float* y;
+        uint32_t size;
+        uint32_t nin;
+        uint32_t nout;
+        uint32_t batch_size;
+        uint32_t epochs;
+        std::mt19937 gen;
+
+        std::vector<std::vector<float>> slots;  // per slot, batch_size rows of inputs then of targets
+        std::vector<Batch> batches;
+        SpscQueue ready;
+        SpscQueue recycled;
+        uint32_t current;
+        bool finished;
+        std::atomic<bool> stopping;
+        std::thread producer;
+
+        void produce();
+
+    public:
+        BatchLoader(const float* x, const float* y, uint32_t size, uint32_t nin, uint32_t nout, uint32_t batch_size,
+                    uint32_t epochs=1, uint32_t seed=std::random_device()(), uint32_t prefetch=2);
+        ~BatchLoader();
+
+        BatchLoader(const BatchLoader&) = delete;
+        BatchLoader& operator=(const BatchLoader&) = delete;
+
+        const Batch* next();
+};
+
+#endif
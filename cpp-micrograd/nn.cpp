@@ -1,20 +1,26 @@
 #include "engine.h"
+#include "gemm.h"
 #include "nn.h"
+#include "optim.h"
+#include "profile.h"
+#include <stdexcept>
 #include <iostream>
 #include<vector>
 #include <random>
+#include <cstring>
 
 /**
  * @brief Module class
  *
  * The Module class represents a base class for neural network modules.
  * It provides methods for zeroing out the gradients of the parameters.
+ * The parameters of a module are one contiguous range of the ParamStore, so this is a single memset.
  */
 
-void Module::zero_grad(){
-    for (auto& weight: parameters()){
-        weight->set_grad(0.0);
-    }
+template <typename T>
+void BasicModule<T>::zero_grad(){
+    Parameters params = parameters();
+    std::memset(params.grad(), 0, params.size() * sizeof(T));
 }
 
 /**
@@ -23,53 +29,44 @@ void Module::zero_grad(){
  * The Neuron class represents a single neuron in a neural network layer.
  * It holds the weights and bias associated with the neuron and provides
  * functionality for computing the output of the neuron.
+ * With nonlin, the activation act is applied to the output (ReLU by default).
  */
-Neuron::Neuron (int nin, bool nonlin){
+template <typename T>
+BasicNeuron<T>::BasicNeuron (int nin, bool nonlin, Act act){
     this->nonlin = nonlin;
+    this->act = nonlin ? act : Act::NONE;
 
     std::random_device rd;
     std::mt19937 gen(rd());
     std::uniform_real_distribution<> dis(-1.0, 1.0);
     this->weights.reserve(nin);
     for (int i = 0; i < nin; ++i) {
-        auto weight = std::make_shared<Value>(dis(gen));
+        auto weight = Value::parameter(dis(gen));
         this->weights.emplace_back(weight);
     }
 }
 
-std::shared_ptr<Value> Neuron::operator()(std::vector<std::shared_ptr<Value>>& x){
-    std::shared_ptr<Value> act = std::make_shared<Value>(0.0);;
-    for (int i=0; i<x.size(); ++i){
-        act = act + (x[i]*weights[i]);
-    }
-    act = act+bias;
-    
-    if (nonlin) {
-        // return act.relu();
-        return act;
-    }
-    return act;
-
+template <typename T>
+BasicValue<T> BasicNeuron<T>::operator()(std::vector<Value>& x){
+    // act(w.x + b) as a single fused node, instead of a mul and an add node per input and one more for the activation.
+    return dot(weights, x, bias, act);
 }
 
-void Neuron::show_parameters() {
+template <typename T>
+void BasicNeuron<T>::show_parameters() {
     std::cout << "weights: ";
     for (auto& weight: this->weights){
-        std::cout << weight->get_data() << ", ";
+        std::cout << weight.get_data() << ", ";
     }
-    std::cout<<"bias: "<<bias->get_data()<<std::endl;
+    std::cout<<"bias: "<<bias.get_data()<<std::endl;
 }
 
-std::vector<std::shared_ptr<Value>> Neuron::parameters() {
-    std::vector<std::shared_ptr<Value>> parameters;
-    parameters.reserve(weights.size() + 1);
-
-    for (auto& weight : weights) {
-        parameters.emplace_back(weight);
-    }
-    parameters.emplace_back(bias);
-
-    return parameters;
+/**
+ * @brief The bias followed by the weights, in the order they were created.
+ */
+template <typename T>
+BasicParameters<T> BasicNeuron<T>::parameters() {
+    return Parameters(bias.get_id() & ~PARAM_BIT, weights.size() + 1);
 }
 
 /**
@@ -79,18 +76,25 @@ std::vector<std::shared_ptr<Value>> Neuron::parameters() {
  * It consists of multiple neurons and provides functionality for computing
  * the output of the layer and accessing the layer's parameters.
 */
-Layer::Layer(int nin, int nout){
+template <typename T>
+BasicLayer<T>::BasicLayer(int nin, int nout, bool nonlin, Act act){
     total_params=(nin+1)*nout;
+    this->act = nonlin ? act : Act::NONE;
     neurons.reserve(nout+1);
 
+    // Each Neuron creates its bias and then its nin weights back to back in the ParamStore,
+    // so the whole layer ends up as one [nout, nin+1] block starting here, which is what Tensor::linear() reads.
+    params = BasicParamStore<T>::global().size();
+
     for (int i=0; i< nout; ++i){
-        Neuron neuron(nin, true);
+        BasicNeuron<T> neuron(nin, nonlin, act);
         neurons.emplace_back(neuron);
     }
 }
 
-std::vector<std::shared_ptr<Value>> Layer::operator()(std::vector<std::shared_ptr<Value>> x){
-    std::vector<std::shared_ptr<Value>> out;
+template <typename T>
+std::vector<BasicValue<T>> BasicLayer<T>::operator()(std::vector<Value> x){
+    std::vector<Value> out;
     out.reserve(neurons.size()+1);
     for (auto& neuron: neurons){
         out.emplace_back(neuron(x));
@@ -98,23 +102,66 @@ std::vector<std::shared_ptr<Value>> Layer::operator()(std::vector<std::shared_pt
     return out;
 }
 
-std::vector<std::shared_ptr<Value>> Layer::parameters() {
-    std::vector<std::shared_ptr<Value>> parameters;
-    parameters.reserve(total_params + 1);
+/**
+ * @brief Runs the whole layer on a [batch, nin] tensor at once.
+ * Instead of nout scalar neurons per example this is a single matrix-valued node, computed by a blocked matrix multiply,
+ * with the activation applied inside it.
+ * It gives the same result as calling the scalar version on every row.
+ */
+template <typename T>
+BasicTensor<T> BasicLayer<T>::operator()(const Tensor& x){
+    return Tensor::linear(x, params, neurons.size(), act);
+}
 
-    for (auto neuron : neurons) {
-        for(auto weight:  neuron.parameters()){
-            parameters.emplace_back(weight);
+/**
+ * @brief Inference on plain floats: out = act(b + x * W^T) for a row-major [batch, nin] x, into a [batch, nout] out.
+ * This is the forward of Tensor::linear() without the graph: no node, no grad, nothing allocated.
+ */
+template <typename T>
+void BasicLayer<T>::predict(const T* x, uint32_t batch, T* out){
+    const T* w = parameters().data();
+    int nin = this->nin();
+    int nout = this->nout();
+    if (batch == 1){
+        // A single example is a matrix-vector product, each output one dot product over a contiguous row of W,
+        // packing it for gemm() would cost more than the product itself.
+        for (int j=0; j<nout; ++j){
+            const T* row = w + j*(nin+1);
+            T sum = row[0];
+            for (int i=0; i<nin; ++i){
+                sum += row[i+1] * x[i];
+            }
+            out[j] = sum;
+        }
+        activate_forward(act, out, out, nout);
+        return;
+    }
+    for (uint32_t b=0; b<batch; ++b){
+        for (int j=0; j<nout; ++j){
+            out[b*nout + j] = w[j*(nin+1)];
         }
     }
+    gemm(false, true, batch, nout, nin, x, nin, w + 1, nin + 1, out, nout);
+    activate_forward(act, out, out, batch*nout);
+}
+
+template <typename T>
+int BasicLayer<T>::nin() const {
+    return total_params / neurons.size() - 1;
+}
 
-    return parameters;
+/**
+ * @brief All [nout, nin+1] parameters of the layer, as a view of the ParamStore.
+ */
+template <typename T>
+BasicParameters<T> BasicLayer<T>::parameters() {
+    return Parameters(params, total_params);
 }
 
-void Layer::show_parameters() {
-    int i=0;
+template <typename T>
+void BasicLayer<T>::show_parameters() {
     std::cout<<"Layer Weights: "<<total_params<<std::endl;
-    for (auto neuron : neurons) {
+    for (auto& neuron : neurons) {
         neuron.show_parameters();
     }
 }
@@ -126,52 +173,215 @@ void Layer::show_parameters() {
  * The MLP class represents a Multi-Layer Perceptron neural network.
  * It consists of multiple layers and provides functionality for
  * computing the output of the network and accessing the network's parameters.
+ * Every layer but the last applies the activation act, the last one is linear.
 */
 
-MLP::MLP(int nin, std::vector<int> nout) {
+template <typename T>
+BasicMLP<T>::BasicMLP(int nin, std::vector<int> nout, Act act) {
     layers.reserve(nout.size()+1);
     total_params=0;
+    // The layers are created one after the other, so all of their parameters form a single block starting here.
+    params = BasicParamStore<T>::global().size();
+    int last = static_cast<int>(nout.size()) - 1;
 
-    for (int i=0; i<nout.size(); ++i){
+    for (int i=0; i<=last; ++i){
         if (i==0){
-            layers.emplace_back(Layer(nin, nout[i]));
-            total_params=total_params+nin*nout[i];
+            layers.emplace_back(BasicLayer<T>(nin, nout[i], i != last, act));
+            total_params=total_params+(nin+1)*nout[i];
         }
         else{
-            layers.emplace_back(Layer(nout[i-1], nout[i]));
-            total_params=total_params+nout[i-1]*nout[i];
+            layers.emplace_back(BasicLayer<T>(nout[i-1], nout[i], i != last, act));
+            total_params=total_params+(nout[i-1]+1)*nout[i];
+        }
+    }
+
+}
+
+/**
+ * @brief Inference mode: runs the network on a row-major [batch, nin] float matrix and writes the [batch, nout] outputs to out.
+ * Nothing is recorded for backward(): no Value, node or tensor is created, every layer is one matrix multiply
+ * straight from the parameters, followed by its activation in place.
+ * The activations in between go to two buffers that are reused across calls (per thread),
+ * so after the first call with a given size this does not allocate at all.
+ */
+template <typename T>
+void BasicMLP<T>::predict(const T* x, uint32_t batch, T* out){
+    thread_local std::vector<T> buffers[2];
+    const T* in = x;
+    for (size_t i=0; i<layers.size(); ++i){
+        T* dst = out;
+        if (i+1 != layers.size()){
+            std::vector<T>& buffer = buffers[i%2];
+            if (buffer.size() < batch*layers[i].nout()){
+                buffer.resize(batch*layers[i].nout());
+            }
+            dst = buffer.data();
         }
+        layers[i].predict(in, batch, dst);
+        in = dst;
     }
+}
+
+/**
+ * @brief Same as above, for ex. `auto y = mlp.predict({0, 1});` for a single example.
+ */
+template <typename T>
+std::vector<T> BasicMLP<T>::predict(const std::vector<T>& x, uint32_t batch){
+    std::vector<T> out(batch*layers.back().nout());
+    predict(x.data(), batch, out.data());
+    return out;
+}
 
+/**
+ * @brief Exports the network as it is right now to a FrozenMLP, for serving.
+ * The weights are copied, so training can go on (or the MLP go away) without touching the frozen copy.
+ * Each layer is re-laid out from its [nout, nin+1] rows of bias and weights to the transposed [nin, nout]
+ * weights followed by the biases, which is what FrozenMLP::forward() reads.
+ * A FrozenMLP (and so a checkpoint) is always float, the weights of a double MLP are rounded to float on the way.
+ */
+template <typename T>
+FrozenMLP BasicMLP<T>::freeze(){
+    std::vector<uint32_t> sizes;
+    std::vector<Act> acts;
+    std::vector<float> weights;
+    weights.reserve(total_params);
+    sizes.push_back(layers.front().nin());
+    for (auto& layer: layers){
+        int nin = layer.nin();
+        int nout = layer.nout();
+        const T* w = layer.parameters().data();
+        for (int i=0; i<nin; ++i){
+            for (int j=0; j<nout; ++j){
+                weights.push_back(w[j*(nin+1) + i+1]);
+            }
+        }
+        for (int j=0; j<nout; ++j){
+            weights.push_back(w[j*(nin+1)]);
+        }
+        sizes.push_back(nout);
+        acts.push_back(layer.activation());
+    }
+    return FrozenMLP(sizes, acts, weights);
 }
 
-std::vector<std::shared_ptr<Value>> MLP::operator()(std::vector<std::shared_ptr<Value>> x){
-    for (auto layer: layers){
-        x = layer(x);
+/**
+ * @brief Writes the network to a checkpoint file, and the state of its optimizer too if one is given,
+ * for ex. `mlp.save("model.ckpt", &optimizer);` to resume training later, or just `mlp.save("model.ckpt");` to serve it.
+ * The file can be served as is with FrozenMLP::load(), and loaded by c-micrograd as well.
+ */
+template <typename T>
+void BasicMLP<T>::save(const std::string& path, const Optimizer* optimizer){
+    std::vector<float> state;
+    if (optimizer){
+        state.resize(optimizer->state_size());
+        optimizer->save_state(state.data());
     }
-    return x;
+    freeze().save(path, state.data(), state.size());
 }
 
-std::vector<std::shared_ptr<Value>> MLP::parameters() {
-    std::vector<std::shared_ptr<Value>> parameters;
-    parameters.reserve(total_params + 1);
+/**
+ * @brief Reads the weights (and the optimizer state, if an optimizer is given) back from a checkpoint file.
+ * The file is mapped rather than read, and its weights copied straight into the ParamStore (widened to double for a double MLP).
+ * Throws std::runtime_error if the checkpoint is of a network with other layer sizes or activations,
+ * or if its optimizer state does not fit the optimizer.
+ */
+template <typename T>
+void BasicMLP<T>::load(const std::string& path, Optimizer* optimizer){
+    Checkpoint checkpoint(path);
+    bool matches = checkpoint.layers() == layers.size() && checkpoint.sizes()[0] == uint32_t(layers.front().nin());
+    for (size_t l=0; matches && l<layers.size(); ++l){
+        matches = checkpoint.sizes()[l+1] == uint32_t(layers[l].nout()) && checkpoint.act(l) == layers[l].activation();
+    }
+    if (!matches){
+        throw std::runtime_error("MLP::load: " + path + " holds a network of another shape");
+    }
+    if (checkpoint.weights_size() != parameters().size()){
+        throw std::runtime_error("MLP::load: " + path + " holds " + std::to_string(checkpoint.weights_size())
+                                 + " weights, the network has " + std::to_string(parameters().size()));
+    }
+    uint64_t n_state = optimizer ? optimizer->state_size() : 0;
+    if (optimizer && checkpoint.state_size() != n_state){
+        throw std::runtime_error("MLP::load: " + path + " holds no state for this optimizer");
+    }
 
-    for (auto layer : layers) {
-        for(auto param:  layer.parameters()){
-            parameters.emplace_back(param);
-            
+    // From [nin, nout] transposed weights then biases, back to [nout, nin+1] rows of bias then weights.
+    const float* src = checkpoint.weights();
+    for (auto& layer: layers){
+        int nin = layer.nin();
+        int nout = layer.nout();
+        T* w = layer.parameters().data();
+        for (int i=0; i<nin; ++i){
+            for (int j=0; j<nout; ++j){
+                w[j*(nin+1) + i+1] = *src++;
+            }
         }
+        for (int j=0; j<nout; ++j){
+            w[j*(nin+1)] = *src++;
+        }
+    }
+    if (optimizer){
+        optimizer->load_state(checkpoint.state());
     }
+}
+
+template <typename T>
+std::vector<BasicValue<T>> BasicMLP<T>::operator()(std::vector<Value> x){
+    // Underneath, the input goes through the layers as a [1, nin] tensor.
+    Tensor out = (*this)(Tensor::stack(x, 1, x.size()));
+    return out.row(0);
+}
+
+/**
+ * @brief Runs the network on a [batch, nin] tensor, one matrix-valued node per layer.
+ */
+template <typename T>
+BasicTensor<T> BasicMLP<T>::operator()(const Tensor& x){
+    PROFILE_SCOPE(ProfilePhase::FORWARD);
+    Tensor out = x;
+    for (auto& layer: layers){
+        out = layer(out);
+    }
+    return out;
+}
+
+/**
+ * @brief Runs the network on a minibatch given as a row-major [batch, nin] float matrix.
+ * The whole batch goes through every layer as one matrix multiply, and the result is a [batch, nout] tensor,
+ * so building the graph, backward() and the update are paid once per batch instead of once per example.
+ * Average the per-example losses with mean() to get the mean gradient out of a single backward().
+ */
+template <typename T>
+BasicTensor<T> BasicMLP<T>::operator()(const std::vector<T>& x, uint32_t batch){
+    return (*this)(Tensor::input(x.data(), batch, x.size() / batch));
+}
 
-    return parameters;
+/**
+ * @brief All parameters of the network, as a view of the ParamStore.
+ * This does not copy anything: data() and grad() point straight into the store,
+ * so a whole update is one pass over two flat float arrays, for ex. axpy(params.size(), -lr, params.grad(), params.data()).
+ */
+template <typename T>
+BasicParameters<T> BasicMLP<T>::parameters() {
+    return Parameters(params, total_params);
 }
 
 
-void MLP::show_parameters() {
+template <typename T>
+void BasicMLP<T>::show_parameters() {
     int i =0;
-    for (auto layer : layers) {
+    for (auto& layer : layers) {
         std::cout<<"\nLayer"<<i<<": "<<std::endl;
         layer.show_parameters();
         i=i+1;
     }
 }
+
+// Like the engine, the modules are compiled once for float and once for double, here.
+template class BasicModule<float>;
+template class BasicModule<double>;
+template class BasicNeuron<float>;
+template class BasicNeuron<double>;
+template class BasicLayer<float>;
+template class BasicLayer<double>;
+template class BasicMLP<float>;
+template class BasicMLP<double>;
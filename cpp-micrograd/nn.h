@@ -2,54 +2,100 @@
 #define NN_H
 
 #include "engine.h"
+#include "frozen.h"
+#include <string>
 #include <iostream>
 #include<vector>
 #include <random>
 
-class Module {
+class Optimizer;
+
+template <typename T>
+class BasicModule {
+    private:
+        typedef BasicValue<T> Value;
+        typedef BasicParameters<T> Parameters;
+        typedef BasicTensor<T> Tensor;
+
     public:
         void zero_grad();
-        virtual std::vector<std::shared_ptr<Value>> parameters()=0;
+        virtual Parameters parameters()=0;
 
 };
 
-class Neuron: public Module{
+template <typename T>
+class BasicNeuron: public BasicModule<T>{
     private:
-        std::vector<std::shared_ptr<Value>> weights;
-        std::shared_ptr<Value> bias = std::make_shared<Value>(0);
+        typedef BasicValue<T> Value;
+        typedef BasicParameters<T> Parameters;
+
+        std::vector<Value> weights;
+        Value bias = Value::parameter(0);
         bool nonlin;
+        Act act;
 
     public:
-        Neuron (int nin, bool nonlin=true);
-        std::shared_ptr<Value> operator()(std::vector<std::shared_ptr<Value>>& x);
-        std::vector<std::shared_ptr<Value>> parameters() override;
+        BasicNeuron (int nin, bool nonlin=true, Act act=Act::RELU);
+        Value operator()(std::vector<Value>& x);
+        Parameters parameters() override;
         void show_parameters();
     
 };
 
-class Layer: public Module{
+template <typename T>
+class BasicLayer: public BasicModule<T>{
     private:
-        std::vector<Neuron> neurons;
+        typedef BasicValue<T> Value;
+        typedef BasicParameters<T> Parameters;
+        typedef BasicTensor<T> Tensor;
+
+        std::vector<BasicNeuron<T>> neurons;
         int total_params;
+        uint32_t params;
+        Act act;
 
     public:
-        Layer(int nin, int nout);
-        std::vector<std::shared_ptr<Value>> operator()(std::vector<std::shared_ptr<Value>> x);
-        std::vector<std::shared_ptr<Value>> parameters() override ;
+        BasicLayer(int nin, int nout, bool nonlin=true, Act act=Act::RELU);
+        std::vector<Value> operator()(std::vector<Value> x);
+        Tensor operator()(const Tensor& x);
+        void predict(const T* x, uint32_t batch, T* out);
+        int nin() const;
+        int nout() const { return neurons.size(); }
+        Act activation() const { return act; }
+        Parameters parameters() override ;
         void show_parameters() ;
 
 };
 
-class MLP: public Module{
+template <typename T>
+class BasicMLP: public BasicModule<T>{
     private:
-        std::vector<Layer> layers;
+        typedef BasicValue<T> Value;
+        typedef BasicParameters<T> Parameters;
+        typedef BasicTensor<T> Tensor;
+
+        std::vector<BasicLayer<T>> layers;
         int total_params;
+        uint32_t params;
     public:
-        MLP(int nin, std::vector<int> nout) ;
-        std::vector<std::shared_ptr<Value>> operator()(std::vector<std::shared_ptr<Value>> x);
-        std::vector<std::shared_ptr<Value>> parameters() override ;
+        BasicMLP(int nin, std::vector<int> nout, Act act=Act::RELU) ;
+        std::vector<Value> operator()(std::vector<Value> x);
+        Tensor operator()(const Tensor& x);
+        Tensor operator()(const std::vector<T>& x, uint32_t batch);
+        const std::vector<BasicLayer<T>>& get_layers() const { return layers; }
+        void predict(const T* x, uint32_t batch, T* out);
+        std::vector<T> predict(const std::vector<T>& x, uint32_t batch=1);
+        FrozenMLP freeze();
+        void save(const std::string& path, const Optimizer* optimizer=nullptr);
+        void load(const std::string& path, Optimizer* optimizer=nullptr);
+        Parameters parameters() override ;
         void show_parameters() ;
 
 };
 
+typedef BasicModule<float> Module;
+typedef BasicNeuron<float> Neuron;
+typedef BasicLayer<float> Layer;
+typedef BasicMLP<float> MLP;
+
 #endif
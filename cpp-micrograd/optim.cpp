@@ -0,0 +1,186 @@
+#include "engine.h"
+#include "optim.h"
+#include "profile.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX512F__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+/**
+    * @brief Optimizer is the base class of the update rules.
+
+    * An optimizer works on a Parameters view, i.e. on the flat data and grad buffers of a whole model,
+    * and keeps whatever state it needs (velocity, moments) in flat buffers of the same size.
+    * So step() is a single pass over a handful of contiguous float arrays, with no per-parameter calls.
+    * Build with `-O3 -march=native` to get the vectorized passes.
+
+    * For ex.
+    * Adam optimizer(mlp.parameters(), 1e-3);
+    * optimizer.zero_grad();
+    * loss.backward();
+    * optimizer.step();
+
+    * @param params The parameters to update, usually module.parameters().
+
+    * save_state() and load_state() copy that state to and from a flat array of state_size() floats,
+    * which is what MLP::save() and MLP::load() put in a checkpoint so training can resume where it stopped.
+*/
+
+/**
+     * @brief Sets the grads of all parameters to 0, same as Module::zero_grad().
+*/
+void Optimizer::zero_grad() {
+    std::memset(params.grad(), 0, params.size() * sizeof(float));
+}
+
+/**
+    * @brief Stochastic gradient descent, optionally with momentum.
+
+    * Without momentum: w = w - lr * grad.
+    * With momentum:    u = momentum * u + grad, w = w - lr * u.
+
+    * @param lr Learning rate.
+    * @param momentum Momentum factor, 0 for plain SGD.
+*/
+SGD::SGD(Parameters params, float lr, float momentum) : Optimizer(params), lr(lr), momentum(momentum) {
+    if (momentum != 0.0) {
+        velocity.assign(params.size(), 0.0);
+    }
+}
+
+void SGD::step() {
+    PROFILE_SCOPE(ProfilePhase::OPTIMIZER);
+    int n = params.size();
+    float* __restrict w = params.data();
+    const float* __restrict g = params.grad();
+    if (momentum == 0.0) {
+        for (int i = 0; i < n; ++i) {
+            w[i] -= lr * g[i];
+        }
+        return;
+    }
+    float* __restrict u = velocity.data();
+    for (int i = 0; i < n; ++i) {
+        u[i] = momentum * u[i] + g[i];
+        w[i] -= lr * u[i];
+    }
+}
+
+/**
+     * @brief The whole Adam update of n parameters in one pass:
+     *     g = grad + l2 * w
+     *     m = beta1 * m + (1 - beta1) * g
+     *     v = beta2 * v + (1 - beta2) * g^2
+     *     w = shrink * w - step_size * m / (sqrt(v) + eps)
+     * The bias corrections are folded into step_size and eps by the caller, so there is no per-element division by them.
+     * The compiler does not vectorize sqrt on its own (it has to keep errno), hence the explicit AVX and AVX-512 loops.
+*/
+static void adam_update(int n, float* __restrict w, const float* __restrict grad, float* __restrict m, float* __restrict v,
+                        float beta1, float beta2, float step_size, float eps, float l2, float shrink) {
+    int i = 0;
+#if defined(__AVX512F__)
+    const __m512 b1 = _mm512_set1_ps(beta1), c1 = _mm512_set1_ps(1 - beta1);
+    const __m512 b2 = _mm512_set1_ps(beta2), c2 = _mm512_set1_ps(1 - beta2);
+    const __m512 lr = _mm512_set1_ps(step_size), ep = _mm512_set1_ps(eps);
+    const __m512 decay = _mm512_set1_ps(l2), keep = _mm512_set1_ps(shrink);
+    for (; i + 16 <= n; i += 16) {
+        __m512 wi = _mm512_loadu_ps(w + i);
+        __m512 gi = _mm512_add_ps(_mm512_loadu_ps(grad + i), _mm512_mul_ps(decay, wi));
+        __m512 mi = _mm512_add_ps(_mm512_mul_ps(b1, _mm512_loadu_ps(m + i)), _mm512_mul_ps(c1, gi));
+        __m512 vi = _mm512_add_ps(_mm512_mul_ps(b2, _mm512_loadu_ps(v + i)), _mm512_mul_ps(c2, _mm512_mul_ps(gi, gi)));
+        __m512 update = _mm512_div_ps(_mm512_mul_ps(lr, mi), _mm512_add_ps(_mm512_sqrt_ps(vi), ep));
+        _mm512_storeu_ps(m + i, mi);
+        _mm512_storeu_ps(v + i, vi);
+        _mm512_storeu_ps(w + i, _mm512_sub_ps(_mm512_mul_ps(keep, wi), update));
+    }
+#elif defined(__AVX__)
+    const __m256 b1 = _mm256_set1_ps(beta1), c1 = _mm256_set1_ps(1 - beta1);
+    const __m256 b2 = _mm256_set1_ps(beta2), c2 = _mm256_set1_ps(1 - beta2);
+    const __m256 lr = _mm256_set1_ps(step_size), ep = _mm256_set1_ps(eps);
+    const __m256 decay = _mm256_set1_ps(l2), keep = _mm256_set1_ps(shrink);
+    for (; i + 8 <= n; i += 8) {
+        __m256 wi = _mm256_loadu_ps(w + i);
+        __m256 gi = _mm256_add_ps(_mm256_loadu_ps(grad + i), _mm256_mul_ps(decay, wi));
+        __m256 mi = _mm256_add_ps(_mm256_mul_ps(b1, _mm256_loadu_ps(m + i)), _mm256_mul_ps(c1, gi));
+        __m256 vi = _mm256_add_ps(_mm256_mul_ps(b2, _mm256_loadu_ps(v + i)), _mm256_mul_ps(c2, _mm256_mul_ps(gi, gi)));
+        __m256 update = _mm256_div_ps(_mm256_mul_ps(lr, mi), _mm256_add_ps(_mm256_sqrt_ps(vi), ep));
+        _mm256_storeu_ps(m + i, mi);
+        _mm256_storeu_ps(v + i, vi);
+        _mm256_storeu_ps(w + i, _mm256_sub_ps(_mm256_mul_ps(keep, wi), update));
+    }
+#endif
+    for (; i < n; ++i) {
+        float gi = grad[i] + l2 * w[i];
+        m[i] = beta1 * m[i] + (1 - beta1) * gi;
+        v[i] = beta2 * v[i] + (1 - beta2) * gi * gi;
+        w[i] = shrink * w[i] - step_size * m[i] / (std::sqrt(v[i]) + eps);
+    }
+}
+
+/**
+     * @brief The state is the velocity, empty without momentum.
+*/
+void SGD::save_state(float* state) const {
+    std::memcpy(state, velocity.data(), velocity.size() * sizeof(float));
+}
+
+void SGD::load_state(const float* state) {
+    std::memcpy(velocity.data(), state, velocity.size() * sizeof(float));
+}
+
+/**
+    * @brief Adam, with the first and second moment of every parameter kept in two flat buffers.
+
+    * weight_decay is classic L2 regularisation: it is added to the gradient (grad + weight_decay * w) before the moments are updated.
+    * For decoupled weight decay use AdamW.
+
+    * @param lr Learning rate.
+    * @param beta1, beta2 Decay rates of the first and second moment.
+    * @param eps Added to the denominator for numerical stability.
+    * @param weight_decay L2 penalty.
+*/
+Adam::Adam(Parameters params, float lr, float beta1, float beta2, float eps, float weight_decay)
+    : Adam(params, lr, beta1, beta2, eps, weight_decay, false) {}
+
+Adam::Adam(Parameters params, float lr, float beta1, float beta2, float eps, float weight_decay, bool decoupled)
+    : Optimizer(params), lr(lr), beta1(beta1), beta2(beta2), eps(eps), weight_decay(weight_decay), decoupled(decoupled), t(0) {
+    m.assign(params.size(), 0.0);
+    v.assign(params.size(), 0.0);
+}
+
+void Adam::step() {
+    PROFILE_SCOPE(ProfilePhase::OPTIMIZER);
+    t += 1;
+    // lr * m_hat / (sqrt(v_hat) + eps) == step_size * m / (sqrt(v) + eps * sqrt(1 - beta2^t))
+    float correction1 = 1 - std::pow(beta1, t);
+    float correction2 = std::sqrt(1 - std::pow(beta2, t));
+    float step_size = lr * correction2 / correction1;
+    float l2 = decoupled ? 0.0 : weight_decay;
+    float shrink = decoupled ? 1 - lr * weight_decay : 1.0;
+    adam_update(params.size(), params.data(), params.grad(), m.data(), v.data(),
+                beta1, beta2, step_size, eps * correction2, l2, shrink);
+}
+
+/**
+     * @brief The state is the step count (its bits, in the first float), then the first and then the second moments.
+*/
+void Adam::save_state(float* state) const {
+    std::memcpy(state, &t, sizeof(float));
+    std::memcpy(state + 1, m.data(), m.size() * sizeof(float));
+    std::memcpy(state + 1 + m.size(), v.data(), v.size() * sizeof(float));
+}
+
+void Adam::load_state(const float* state) {
+    std::memcpy(&t, state, sizeof(float));
+    std::memcpy(m.data(), state + 1, m.size() * sizeof(float));
+    std::memcpy(v.data(), state + 1 + m.size(), v.size() * sizeof(float));
+}
+
+/**
+    * @brief Adam with decoupled weight decay (Loshchilov & Hutter): w = w - lr * weight_decay * w, next to the Adam step,
+    * instead of adding the decay to the gradient. The decay is applied in the same pass as the update.
+*/
+AdamW::AdamW(Parameters params, float lr, float beta1, float beta2, float eps, float weight_decay)
+    : Adam(params, lr, beta1, beta2, eps, weight_decay, true) {}
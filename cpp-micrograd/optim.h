@@ -0,0 +1,65 @@
+#ifndef OPTIM_H
+#define OPTIM_H
+
+#include "engine.h"
+#include <vector>
+
+class Optimizer {
+    protected:
+        Parameters params;
+
+    public:
+        explicit Optimizer(Parameters params) : params(params) {}
+        virtual ~Optimizer() = default;
+
+        void zero_grad();
+        virtual void step()=0;
+
+        virtual uint64_t state_size() const { return 0; }
+        virtual void save_state(float* /*state*/) const {}
+        virtual void load_state(const float* /*state*/) {}
+};
+
+class SGD: public Optimizer {
+    private:
+        float lr;
+        float momentum;
+        std::vector<float, AlignedAllocator<float>> velocity;
+
+    public:
+        SGD(Parameters params, float lr, float momentum=0.0);
+        void step() override;
+        uint64_t state_size() const override { return velocity.size(); }
+        void save_state(float* state) const override;
+        void load_state(const float* state) override;
+};
+
+class Adam: public Optimizer {
+    private:
+        float lr;
+        float beta1;
+        float beta2;
+        float eps;
+        float weight_decay;
+        bool decoupled;
+        int t;
+        std::vector<float, AlignedAllocator<float>> m;
+        std::vector<float, AlignedAllocator<float>> v;
+
+    protected:
+        Adam(Parameters params, float lr, float beta1, float beta2, float eps, float weight_decay, bool decoupled);
+
+    public:
+        Adam(Parameters params, float lr=1e-3, float beta1=0.9, float beta2=0.999, float eps=1e-8, float weight_decay=0.0);
+        void step() override;
+        uint64_t state_size() const override { return 1 + m.size() + v.size(); }
+        void save_state(float* state) const override;
+        void load_state(const float* state) override;
+};
+
+class AdamW: public Adam {
+    public:
+        AdamW(Parameters params, float lr=1e-3, float beta1=0.9, float beta2=0.999, float eps=1e-8, float weight_decay=1e-2);
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include "engine.h"
+#include "nn.h"
+#include "parallel.h"
+#include <algorithm>
+
+/**
+    * @brief ThreadPool keeps a fixed set of worker threads around, so a training step does not pay for creating threads.
+
+    * run(task) hands task(i) to worker i, for every worker, and blocks until all of them are done.
+    * That is all a data-parallel step needs: one shard per worker, then a barrier.
+
+    * @param threads number of workers, at least one.
+*/
+ThreadPool::ThreadPool(uint32_t threads) {
+    generation = 0;
+    pending = 0;
+    stopping = false;
+    threads = std::max(threads, 1u);
+    workers.reserve(threads);
+    for (uint32_t i = 0; i < threads; ++i) {
+        workers.emplace_back(&ThreadPool::work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker: workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::work(uint32_t index) {
+    uint64_t seen = 0;
+    while (true) {
+        std::function<void(uint32_t)>* current;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            current = &task;
+        }
+
+        std::exception_ptr failure;
+        try {
+            (*current)(index);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (failure && !error) {
+            error = failure;
+        }
+        if (--pending == 0) {
+            done.notify_one();
+        }
+    }
+}
+
+/**
+     * @brief Runs task(i) on worker i for every i in [0, size()) and waits for all of them.
+     * If any of them throws, the first exception is rethrown here once all workers are done.
+*/
+void ThreadPool::run(const std::function<void(uint32_t)>& task) {
+    std::unique_lock<std::mutex> lock(mutex);
+    this->task = task;
+    error = nullptr;
+    pending = size();
+    ++generation;
+    wake.notify_all();
+    done.wait(lock, [&] { return pending == 0; });
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+    * @brief DataParallel trains an MLP on minibatches that are split across a ThreadPool.
+
+    * Every step cuts the minibatch into one shard of rows per worker.
+    * Each worker builds the graph of its shard in its own (thread-local) Arena by calling loss(mlp, x, y, rows),
+    * and backpropagates it into a gradient buffer of its own instead of the shared parameter grads,
+    * so the workers never write to the same memory. The buffers only cover mlp.parameters(), not the whole ParamStore,
+    * so other models living next to it cost nothing, but loss must not use any parameter outside of mlp.
+    * Then the buffers are all-reduced into the parameters' grads, again in parallel, every worker summing up one slice of them.
+    * loss is expected to return the mean loss over its rows, the shards are weighted by their size,
+    * so the result is the same mean loss and mean gradient a single-threaded step on the whole minibatch gives.
+
+    * The parameters are only read during a step, creating new parameters (or Modules) while it runs is not allowed.
+
+    * For ex.
+    * DataParallel trainer(mlp, [](MLP& mlp, const float* x, const float* y, uint32_t batch) { ... return mean(losses); });
+    * mlp.zero_grad();
+    * float loss = trainer.step(x, y, batch);
+    * // update the parameters as usual
+
+    * @param mlp the model, passed on to loss.
+    * @param loss builds the loss of a shard of rows: x is [rows, nin], y is [rows, nout], both row-major.
+    * @param threads number of workers.
+*/
+DataParallel::DataParallel(MLP& mlp, LossFn loss, uint32_t threads) : mlp(mlp), loss(loss), pool(threads) {
+    grads.resize(pool.size());
+    losses.resize(pool.size());
+}
+
+/**
+     * @brief Forward and backward of one minibatch, sharded across the workers.
+     * The mean gradient is added to the parameters' grads, so call zero_grad() before, like before backward().
+     * @param x the [batch, nin] inputs, row-major.
+     * @param y the [batch, nout] targets, row-major.
+     * @param batch number of rows.
+     * @return The mean loss (type: float) over the minibatch.
+*/
+float DataParallel::step(const std::vector<float>& x, const std::vector<float>& y, uint32_t batch) {
+    return step(x.data(), x.size() / batch, y.data(), y.size() / batch, batch);
+}
+
+/**
+     * @brief Same as above, for a batch that is not in vectors, for ex. one from a BatchLoader.
+*/
+float DataParallel::step(const float* x, uint32_t nin, const float* y, uint32_t nout, uint32_t batch) {
+    uint32_t shards = std::min(pool.size(), batch);
+    Parameters params = mlp.parameters();
+    uint32_t num_params = params.size();
+
+    pool.run([&](uint32_t shard) {
+        losses[shard] = 0.0;
+        if (shard >= shards) {
+            return;
+        }
+        uint32_t begin = static_cast<uint64_t>(batch) * shard / shards;
+        uint32_t end = static_cast<uint64_t>(batch) * (shard + 1) / shards;
+        std::vector<float>& grad = grads[shard];
+        grad.assign(num_params, 0.0);
+
+        Arena& arena = Arena::current();
+        arena.redirect_param_grads(grad.data(), params.offset());
+        try {
+            GraphScope scope(arena);
+            Value shard_loss = loss(mlp, x + begin * nin, y + begin * nout, end - begin);
+            shard_loss.backward();
+            losses[shard] = shard_loss.get_data() * (end - begin) / batch;
+        } catch (...) {
+            arena.redirect_param_grads(nullptr);
+            throw;
+        }
+        arena.redirect_param_grads(nullptr);
+    });
+
+    // All-reduce: worker t owns the t-th slice of the model's parameters and sums it over every shard.
+    float* out = params.grad();
+    pool.run([&](uint32_t slice) {
+        uint32_t begin = static_cast<uint64_t>(num_params) * slice / pool.size();
+        uint32_t end = static_cast<uint64_t>(num_params) * (slice + 1) / pool.size();
+        for (uint32_t shard = 0; shard < shards; ++shard) {
+            uint32_t rows = static_cast<uint64_t>(batch) * (shard + 1) / shards - static_cast<uint64_t>(batch) * shard / shards;
+            float weight = static_cast<float>(rows) / batch;
+            const float* grad = grads[shard].data();
+            for (uint32_t i = begin; i < end; ++i) {
+                out[i] += weight * grad[i];
+            }
+        }
+    });
+
+    float total = 0.0;
+    for (float shard_loss: losses) {
+        total += shard_loss;
+    }
+    return total;
+}
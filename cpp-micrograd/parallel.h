@@ -0,0 +1,55 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "engine.h"
+#include "nn.h"
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        std::function<void(uint32_t)> task;
+        std::exception_ptr error;
+        uint64_t generation;
+        uint32_t pending;
+        bool stopping;
+
+        void work(uint32_t index);
+
+    public:
+        explicit ThreadPool(uint32_t threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        uint32_t size() const { return static_cast<uint32_t>(workers.size()); }
+        void run(const std::function<void(uint32_t)>& task);
+};
+
+class DataParallel {
+    public:
+        typedef std::function<Value(MLP& mlp, const float* x, const float* y, uint32_t batch)> LossFn;
+
+    private:
+        MLP& mlp;
+        LossFn loss;
+        ThreadPool pool;
+        std::vector<std::vector<float>> grads;
+        std::vector<float> losses;
+
+    public:
+        DataParallel(MLP& mlp, LossFn loss, uint32_t threads = std::thread::hardware_concurrency());
+        float step(const std::vector<float>& x, const std::vector<float>& y, uint32_t batch);
+        float step(const float* x, uint32_t nin, const float* y, uint32_t nout, uint32_t batch);
+};
+
+#endif
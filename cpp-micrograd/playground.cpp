@@ -1,33 +1,56 @@
 #include "engine.h"
+#include "expr.h"
 #include <iostream>
 
+// The formula of main() as an expression template (see expr.h). It is constexpr, so the compiler checks its value and gradient here.
+constexpr auto formula = (var<0>() + var<1>()) * var<2>() + var<3>();
+constexpr float inputs[4] = {2.5, 3.7, -3.0, 1.7};
+
+constexpr float formula_grad(int i) {
+    float grad[4] = {};
+    formula.gradient(inputs, grad);
+    return grad[i];
+}
+
+static_assert(formula(inputs) == (inputs[0] + inputs[1]) * inputs[2] + inputs[3], "expression template forward");
+static_assert(formula_grad(0) == inputs[2] && formula_grad(1) == inputs[2]
+              && formula_grad(2) == inputs[0] + inputs[1] && formula_grad(3) == 1, "expression template gradient");
+
 int main() {
     // Use the Value class here
     // ...
-    std::shared_ptr<Value> value1 = std::make_shared<Value>(2.5);
-    std::shared_ptr<Value> value2 = std::make_shared<Value>(3.7);
-    std::shared_ptr<Value> value3 = std::make_shared<Value>(-3.0);
-    std::shared_ptr<Value> value4 = std::make_shared<Value>(1.7);
+    Value value1(2.5);
+    Value value2(3.7);
+    Value value3(-3.0);
+    Value value4(1.7);
 
     // Perform addition using the operator+
-    std::shared_ptr<Value> value1_2 = value1 + value2;
+    Value value1_2 = value1 + value2;
 
     // Perform multiplication using the operator*
-    std::shared_ptr<Value> value_1_2_3 = value1_2 * value3;
+    Value value_1_2_3 = value1_2 * value3;
 
-    std::shared_ptr<Value> result_final = value_1_2_3+value4;
+    Value result_final = value_1_2_3+value4;
 
 
     // Access the result and print the data
-    // std::cout << "Result Final: " << result_final->get_data() << std::endl;
-    // result_final->set_grad(1.0);
-    result_final->backward();
+    // std::cout << "Result Final: " << result_final.get_data() << std::endl;
+    // result_final.set_grad(1.0);
+    result_final.backward();
     std::cout<<"\n\n\n";
     std::cout<<"finall\n";
-    std::cout<<value1->get_data()<<" grad: "<<value1->get_grad()<<std::endl;
-    std::cout<<value2->get_data()<<" grad: "<<value2->get_grad()<<std::endl;
-    std::cout<<value3->get_data()<<" grad: "<<value3->get_grad()<<std::endl;
-    std::cout<<value4->get_data()<<" grad: "<<value4->get_grad()<<std::endl;
+    std::cout<<value1.get_data()<<" grad: "<<value1.get_grad()<<std::endl;
+    std::cout<<value2.get_data()<<" grad: "<<value2.get_grad()<<std::endl;
+    std::cout<<value3.get_data()<<" grad: "<<value3.get_grad()<<std::endl;
+    std::cout<<value4.get_data()<<" grad: "<<value4.get_grad()<<std::endl;
+
+    // The same formula as an expression template: no nodes, just inlined arithmetic.
+    float grad[4] = {};
+    float result = formula.gradient(inputs, grad);
+    std::cout<<"\nexpression template: "<<result<<std::endl;
+    for (int i = 0; i < 4; ++i) {
+        std::cout<<inputs[i]<<" grad: "<<grad[i]<<std::endl;
+    }
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,180 @@
+#ifdef MICROGRAD_PROFILE
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include "profile.h"
+
+static const uint32_t OPS = static_cast<uint32_t>(Op::CUSTOM) + 1;
+static const char* const OP_NAMES[] = {
+    "LEAF", "ADD", "MUL", "POW", "SUB", "DIV", "NEG", "DOT", "MEAN", "INPUT", "STACK",
+    "LINEAR", "ELEM", "ACT", "LOSS", "BATCH_LOSS", "FUSED", "CUSTOM",
+};
+static_assert(sizeof(OP_NAMES) / sizeof(OP_NAMES[0]) == OPS, "OP_NAMES is out of sync with Op");
+
+static const uint32_t PHASES = static_cast<uint32_t>(ProfilePhase::OPTIMIZER) + 1;
+static const char* const PHASE_NAMES[] = {"forward", "topo_sort", "backward", "optimizer"};
+
+struct ProfileEvent {
+    ProfilePhase phase;
+    uint64_t begin;
+    uint64_t end;
+};
+
+/**
+     * @brief What one thread recorded. Threads only ever write to their own, so recording takes no lock.
+     * The records outlive their threads, so the workers of a ThreadPool that is gone still show up in the report.
+*/
+struct ProfileThread {
+    uint32_t tid;
+    std::vector<ProfileEvent> events;
+    uint64_t nodes[OPS];
+    uint64_t bytes;
+};
+
+static std::mutex registry_mutex;
+static std::vector<std::unique_ptr<ProfileThread>> registry;
+static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+static ProfileThread& this_thread() {
+    thread_local ProfileThread* self = nullptr;
+    if (!self) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.emplace_back(new ProfileThread());
+        self = registry.back().get();
+        self->tid = static_cast<uint32_t>(registry.size() - 1);
+        self->events.reserve(1 << 12);
+    }
+    return *self;
+}
+
+/**
+     * @brief Nanoseconds since the program started.
+*/
+uint64_t profile_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void profile_event(ProfilePhase phase, uint64_t begin, uint64_t end) {
+    this_thread().events.push_back({phase, begin, end});
+}
+
+void profile_node(Op op) {
+    ++this_thread().nodes[static_cast<uint32_t>(op)];
+}
+
+void profile_alloc(uint64_t bytes) {
+    this_thread().bytes += bytes;
+}
+
+/**
+     * @brief Forgets everything recorded so far, for ex. to leave the warm-up steps out.
+     * Like the two below, call it while no step is running.
+*/
+void profile_reset() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (auto& thread: registry) {
+        thread->events.clear();
+        std::fill(thread->nodes, thread->nodes + OPS, 0);
+        thread->bytes = 0;
+    }
+}
+
+/**
+     * @brief Prints the time spent in every phase, the nodes created per op and the bytes allocated, over all threads.
+     * A step is one optimizer update, the per-step columns divide by their number.
+     * Times are summed over threads, so with DataParallel a phase can take longer in total than the step itself.
+*/
+void profile_report(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    uint64_t calls[PHASES] = {};
+    uint64_t time[PHASES] = {};
+    uint64_t nodes[OPS] = {};
+    uint64_t bytes = 0;
+    for (auto& thread: registry) {
+        for (const ProfileEvent& event: thread->events) {
+            calls[static_cast<uint32_t>(event.phase)] += 1;
+            time[static_cast<uint32_t>(event.phase)] += event.end - event.begin;
+        }
+        for (uint32_t op = 0; op < OPS; ++op) {
+            nodes[op] += thread->nodes[op];
+        }
+        bytes += thread->bytes;
+    }
+    uint64_t steps = calls[static_cast<uint32_t>(ProfilePhase::OPTIMIZER)];
+    double per_step = steps ? 1.0 / steps : 0.0;
+
+    char line[128];
+    std::snprintf(line, sizeof(line), "%-12s %10s %12s %12s\n", "phase", "calls", "total ms", "ms/step");
+    out << line;
+    for (uint32_t phase = 0; phase < PHASES; ++phase) {
+        std::snprintf(line, sizeof(line), "%-12s %10llu %12.3f %12.4f\n", PHASE_NAMES[phase],
+                      static_cast<unsigned long long>(calls[phase]), time[phase] * 1e-6, time[phase] * 1e-6 * per_step);
+        out << line;
+    }
+    out << "steps: " << steps << "\n\n";
+
+    uint64_t total = 0;
+    std::snprintf(line, sizeof(line), "%-12s %12s %12s\n", "op", "nodes", "nodes/step");
+    out << line;
+    for (uint32_t op = 0; op < OPS; ++op) {
+        total += nodes[op];
+        if (nodes[op]) {
+            std::snprintf(line, sizeof(line), "%-12s %12llu %12.1f\n", OP_NAMES[op],
+                          static_cast<unsigned long long>(nodes[op]), nodes[op] * per_step);
+            out << line;
+        }
+    }
+    std::snprintf(line, sizeof(line), "%-12s %12llu %12.1f\n", "total", static_cast<unsigned long long>(total), total * per_step);
+    out << line;
+    out << "bytes allocated: " << bytes << "\n";
+}
+
+/**
+     * @brief Writes every recorded event as a complete ("X") event of the Chrome trace event format, one track per thread,
+     * and the node counts and bytes allocated under otherData.
+     * Throws std::runtime_error if path cannot be written.
+*/
+void profile_write_trace(const std::string& path) {
+    std::ofstream file(path);
+    if (!file) {
+        throw std::runtime_error("profile_write_trace: cannot write " + path);
+    }
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    uint64_t nodes[OPS] = {};
+    uint64_t bytes = 0;
+    char line[160];
+
+    file << "{\"traceEvents\":[\n";
+    const char* separator = "";
+    for (auto& thread: registry) {
+        std::snprintf(line, sizeof(line), "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+                      separator, thread->tid, thread->tid);
+        file << line;
+        separator = ",\n";
+        for (const ProfileEvent& event: thread->events) {
+            std::snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"cat\":\"micrograd\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%u}",
+                          PHASE_NAMES[static_cast<uint32_t>(event.phase)], event.begin * 1e-3, (event.end - event.begin) * 1e-3, thread->tid);
+            file << line;
+        }
+        for (uint32_t op = 0; op < OPS; ++op) {
+            nodes[op] += thread->nodes[op];
+        }
+        bytes += thread->bytes;
+    }
+    file << "\n],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"bytes_allocated\":" << bytes;
+    for (uint32_t op = 0; op < OPS; ++op) {
+        file << ",\"nodes_" << OP_NAMES[op] << "\":" << nodes[op];
+    }
+    file << "}}\n";
+    if (!file) {
+        throw std::runtime_error("profile_write_trace: cannot write " + path);
+    }
+}
+
+#endif
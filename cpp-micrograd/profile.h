@@ -0,0 +1,67 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "engine.h"
+
+/**
+    * @brief Opt-in instrumentation of the engine, nn and the optimizers.
+
+    * Build everything with -DMICROGRAD_PROFILE (and add profile.cpp) to record, per thread:
+    * - the nodes created, per Op,
+    * - the bytes the arenas and the ParamStore grew by,
+    * - every forward, topo sort, backward and optimizer update, as a timed event.
+    * profile_report() prints a summary table of it, profile_write_trace() writes the events as a Chrome trace
+    * (load it in chrome://tracing or https://ui.perfetto.dev).
+
+    * Without the flag the PROFILE_* hooks below expand to nothing, so the instrumented code is exactly the plain code
+    * and a production build pays nothing for it.
+*/
+enum class ProfilePhase : uint8_t {
+    FORWARD,
+    TOPO_SORT,
+    BACKWARD,
+    OPTIMIZER,
+};
+
+#ifdef MICROGRAD_PROFILE
+
+uint64_t profile_now();
+void profile_event(ProfilePhase phase, uint64_t begin, uint64_t end);
+void profile_node(Op op);
+void profile_alloc(uint64_t bytes);
+
+void profile_reset();
+void profile_report(std::ostream& out);
+void profile_write_trace(const std::string& path);
+
+/**
+     * @brief Times the enclosing block as one event of phase.
+*/
+class ProfileScope {
+    private:
+        ProfilePhase phase;
+        uint64_t begin;
+
+    public:
+        explicit ProfileScope(ProfilePhase phase) : phase(phase), begin(profile_now()) {}
+        ~ProfileScope() { profile_event(phase, begin, profile_now()); }
+        ProfileScope(const ProfileScope&) = delete;
+        ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+#define PROFILE_SCOPE(phase) ProfileScope profile_scope(phase)
+#define PROFILE_NODE(op) profile_node(op)
+#define PROFILE_ALLOC(bytes) profile_alloc(bytes)
+
+#else
+
+#define PROFILE_SCOPE(phase)
+#define PROFILE_NODE(op)
+#define PROFILE_ALLOC(bytes)
+
+#endif
+
+#endif
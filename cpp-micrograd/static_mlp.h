@@ -0,0 +1,234 @@
+#ifndef STATIC_MLP_H
+#define STATIC_MLP_H
+
+#include <array>
+#include <cstdint>
+#include <random>
+#include <stdexcept>
+#include <type_traits>
+#include "activation.h"
+#include "nn.h"
+
+/**
+    * @brief An MLP whose layer sizes are template arguments, for models whose shape is fixed at build time.
+    * BasicStaticMLP<float, 2, 6, 3, 2> (or StaticMLP<2, 6, 3, 2>) is the same network as MLP(2, {6, 3, 2}):
+    * every layer but the last applies act, the last one is linear.
+
+    * All weights live in one std::array, in the layout of MLP::parameters(): per layer, nout rows of [bias, nin weights].
+    * Every size is a constant, so the loops over a layer have known trip counts the compiler unrolls or vectorizes,
+    * and the activations of a pass are std::arrays on the stack: neither predict() nor a training step allocates,
+    * and there is no graph, the gradient is written out by hand layer by layer.
+
+    * For ex.
+    * StaticMLP<2, 6, 3, 2> model;
+    * model.load(mlp);                             // the weights of a trained MLP(2, {6, 3, 2})
+    * model.predict(x, y);                         // one example
+    * model.zero_grad();
+    * float loss = model.backward(x, y, batch);    // mean squared error over a [batch, 2] minibatch, and its gradient
+    * model.step(0.1);                             // plain SGD
+*/
+template <typename T, int... Sizes>
+class BasicStaticMLP {
+    private:
+        static constexpr int size(int i) {
+            constexpr int sizes[] = {Sizes...};
+            return sizes[i];
+        }
+        // Offset of layer l's weights in weights, and of its outputs among all the layers' outputs.
+        static constexpr int weights_at(int l) {
+            int offset = 0;
+            for (int k = 0; k < l; ++k) {
+                offset += (size(k) + 1) * size(k + 1);
+            }
+            return offset;
+        }
+        static constexpr int units_at(int l) {
+            int offset = 0;
+            for (int k = 0; k < l; ++k) {
+                offset += size(k + 1);
+            }
+            return offset;
+        }
+
+    public:
+        static constexpr int LAYERS = sizeof...(Sizes) - 1;
+        static constexpr int NIN = size(0);
+        static constexpr int NOUT = size(LAYERS);
+        static constexpr int PARAMS = weights_at(LAYERS);
+        static constexpr int UNITS = units_at(LAYERS);
+        static_assert(LAYERS >= 1, "StaticMLP needs an input size and at least one layer");
+
+        std::array<T, PARAMS> weights;
+        std::array<T, PARAMS> grads;
+
+    private:
+        Act act;
+
+        template <int L>
+        using Layer = std::integral_constant<int, L>;
+
+        Act activation(int l) const { return l + 1 < LAYERS ? act : Act::NONE; }
+
+        /**
+             * @brief One layer, and recursively the ones after it: z = W in + b, y = act(z).
+             * z and y hold the outputs of all the layers, see units_at().
+        */
+        template <int L>
+        void forward(const T* in, T* z, T* y, Layer<L>) const {
+            constexpr int nin = size(L);
+            constexpr int nout = size(L + 1);
+            const T* w = weights.data() + weights_at(L);
+            T* zl = z + units_at(L);
+            T* yl = y + units_at(L);
+            for (int j = 0; j < nout; ++j) {
+                const T* row = w + j * (nin + 1);
+                T sum = row[0];
+                for (int i = 0; i < nin; ++i) {
+                    sum += row[i + 1] * in[i];
+                }
+                zl[j] = sum;
+            }
+            activate_forward(activation(L), zl, yl, nout);
+            forward(yl, z, y, Layer<L + 1>());
+        }
+        void forward(const T*, T*, T*, Layer<LAYERS>) const {}
+
+        /**
+             * @brief One layer, and recursively the ones before it, given dy, the grad of the loss wrt every layer's outputs.
+             * Adds to the grads of the layer's weights, and writes the grad of its input into the previous layer's dy.
+        */
+        template <int L>
+        void backward(const T* x, const T* z, const T* y, T* dy, Layer<L>) {
+            constexpr int nin = size(L);
+            constexpr int nout = size(L + 1);
+            const T* in = L == 0 ? x : y + units_at(L - 1);
+            const T* w = weights.data() + weights_at(L);
+            T* gw = grads.data() + weights_at(L);
+            std::array<T, nout> dz{};
+            activate_backward(activation(L), z + units_at(L), y + units_at(L), dy + units_at(L), dz.data(), nout);
+            for (int j = 0; j < nout; ++j) {
+                T* row = gw + j * (nin + 1);
+                row[0] += dz[j];
+                for (int i = 0; i < nin; ++i) {
+                    row[i + 1] += dz[j] * in[i];
+                }
+            }
+            if (L > 0) {
+                T* din = dy + units_at(L - 1);
+                for (int i = 0; i < nin; ++i) {
+                    din[i] = 0;
+                }
+                for (int j = 0; j < nout; ++j) {
+                    const T* row = w + j * (nin + 1);
+                    for (int i = 0; i < nin; ++i) {
+                        din[i] += row[i + 1] * dz[j];
+                    }
+                }
+            }
+            backward(x, z, y, dy, Layer<L - 1>());
+        }
+        void backward(const T*, const T*, const T*, T*, Layer<-1>) {}
+
+    public:
+        /**
+             * @brief Random weights in [-1, 1) and zero biases, like MLP(nin, {...}, act).
+        */
+        explicit BasicStaticMLP(Act act = Act::RELU) : act(act) {
+            std::random_device rd;
+            std::mt19937 gen(rd());
+            std::uniform_real_distribution<> dis(-1.0, 1.0);
+            for (int l = 0; l < LAYERS; ++l) {
+                T* w = weights.data() + weights_at(l);
+                for (int k = 0; k < (size(l) + 1) * size(l + 1); ++k) {
+                    w[k] = k % (size(l) + 1) == 0 ? T(0) : T(dis(gen));
+                }
+            }
+            grads.fill(0);
+        }
+
+        /**
+             * @brief Copies the weights and the activation of a regular MLP, which is then free to go away.
+             * Throws std::runtime_error if its layer sizes are not Sizes.
+        */
+        template <typename U>
+        void load(BasicMLP<U>& mlp) {
+            const auto& layers = mlp.get_layers();
+            bool matches = layers.size() == size_t(LAYERS);
+            for (int l = 0; matches && l < LAYERS; ++l) {
+                matches = layers[l].nin() == size(l) && layers[l].nout() == size(l + 1);
+            }
+            if (!matches) {
+                throw std::runtime_error("StaticMLP::load: the MLP has other layer sizes");
+            }
+            const U* src = mlp.parameters().data();
+            for (int i = 0; i < PARAMS; ++i) {
+                weights[i] = T(src[i]);
+            }
+            act = LAYERS > 1 ? layers[0].activation() : act;
+        }
+
+        /**
+             * @brief Inference on one example: x has NIN values, out gets NOUT.
+        */
+        void predict(const T* x, T* out) const {
+            std::array<T, UNITS> z, y;
+            forward(x, z.data(), y.data(), Layer<0>());
+            for (int j = 0; j < NOUT; ++j) {
+                out[j] = y[units_at(LAYERS - 1) + j];
+            }
+        }
+
+        /**
+             * @brief Same as above, for a row-major [batch, NIN] matrix, out is [batch, NOUT].
+        */
+        void predict(const T* x, uint32_t batch, T* out) const {
+            for (uint32_t b = 0; b < batch; ++b) {
+                predict(x + b * NIN, out + b * NOUT);
+            }
+        }
+
+        /**
+             * @brief Forward and backward of a minibatch, what mse_loss(mlp(x, batch), target).backward() is for an MLP.
+             * The mean gradient is added to grads, so call zero_grad() before.
+             * @param x the [batch, NIN] inputs, row-major.
+             * @param target the [batch, NOUT] targets, row-major.
+             * @return The mean squared error (type: T), averaged over the outputs and the batch.
+        */
+        T backward(const T* x, const T* target, uint32_t batch) {
+            std::array<T, UNITS> z, y, dy;
+            T loss = 0;
+            T scale = T(2) / (NOUT * batch);
+            for (uint32_t b = 0; b < batch; ++b) {
+                const T* in = x + b * NIN;
+                const T* t = target + b * NOUT;
+                forward(in, z.data(), y.data(), Layer<0>());
+                const T* out = y.data() + units_at(LAYERS - 1);
+                T* dout = dy.data() + units_at(LAYERS - 1);
+                T sum = 0;
+                for (int j = 0; j < NOUT; ++j) {
+                    T diff = out[j] - t[j];
+                    sum += diff * diff;
+                    dout[j] = scale * diff;
+                }
+                loss += sum / NOUT;
+                backward(in, z.data(), y.data(), dy.data(), Layer<LAYERS - 1>());
+            }
+            return loss / batch;
+        }
+
+        void zero_grad() { grads.fill(0); }
+
+        /**
+             * @brief Plain SGD, the same update as SGD without momentum: w -= lr * grad.
+        */
+        void step(T lr) {
+            for (int i = 0; i < PARAMS; ++i) {
+                weights[i] -= lr * grads[i];
+            }
+        }
+};
+
+template <int... Sizes>
+using StaticMLP = BasicStaticMLP<float, Sizes...>;
+
+#endif
@@ -0,0 +1,83 @@
+#include "engine.h"
+#include "nn.h"
+#include "optim.h"
+#include <sys/resource.h>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/**
+ * @brief Regression check that a training loop runs in constant memory.
+ * Every step builds its graph inside a GraphScope, both the batched (one tensor per layer) and the per-example (Values) way,
+ * and trains on it. Once warmed up, neither the arena nor the peak resident set may grow any more:
+ * a graph that outlives its step shows up as arena nodes that are not released, and after a few thousand steps as RSS.
+ * Exits with 1 if either grew, so it can run in CI next to the build.
+*/
+
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;  // kilobytes on Linux
+}
+
+int main(){
+    const int steps = 20000;
+    const int warmup = 1000;
+    const long tolerance_kb = 512;
+    const uint32_t batch = 32;
+
+    MLP mlp(2, {16, 16, 2});
+    SGD optimizer(mlp.parameters(), 0.01);
+    Arena& arena = Arena::current();
+
+    std::mt19937 gen(0);
+    std::uniform_int_distribution<> bit(0, 1);
+    std::vector<float> x(batch*2), y(batch*2);
+
+    uint32_t arena_before = arena.size();
+    long rss_after_warmup = 0;
+    for (int step=0; step<steps; ++step){
+        for (uint32_t b=0; b<batch; ++b){
+            int a = bit(gen), c = bit(gen);
+            x[b*2] = a;
+            x[b*2+1] = c;
+            y[b*2] = !(a && c);
+            y[b*2+1] = a && c;
+        }
+
+        optimizer.zero_grad();
+        {
+            GraphScope scope;
+            Value loss = mse_loss(mlp(x, batch), y.data());
+            loss.backward();
+        }
+        {
+            // The same minibatch one example at a time, scalar Values all the way, for many more nodes per step.
+            GraphScope scope;
+            std::vector<Value> losses;
+            for (uint32_t b=0; b<batch; ++b){
+                std::vector<Value> in = {Value(x[b*2]), Value(x[b*2+1])};
+                losses.push_back(mse_loss(mlp(in), std::vector<float>{y[b*2], y[b*2+1]}));
+            }
+            mean(losses).backward();
+        }
+        optimizer.step();
+
+        if (arena.size() != arena_before){
+            std::printf("FAIL: step %d left %u nodes in the arena\n", step, arena.size() - arena_before);
+            return 1;
+        }
+        if (step+1 == warmup){
+            rss_after_warmup = peak_rss_kb();
+        }
+    }
+
+    long rss_end = peak_rss_kb();
+    std::printf("peak RSS after %d warm-up steps: %ld KB, after %d steps: %ld KB\n", warmup, rss_after_warmup, steps, rss_end);
+    if (rss_end - rss_after_warmup > tolerance_kb){
+        std::printf("FAIL: peak RSS grew by %ld KB (tolerance %ld KB)\n", rss_end - rss_after_warmup, tolerance_kb);
+        return 1;
+    }
+    std::printf("OK\n");
+    return 0;
+}
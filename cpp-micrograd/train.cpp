@@ -1,8 +1,13 @@
 #include "engine.h"
 #include "nn.h"
+#include "parallel.h"
+#include "optim.h"
+#include "loader.h"
+#include "profile.h"
 #include <vector>
 #include <cmath>
 #include <cstdlib>
+#include <algorithm>
 
 int main(){
     /** 
@@ -29,7 +34,7 @@ int main(){
      * Final architecture:
      * l1: 2 -> l2: 6 -> l3: 3 -> l4: 2
     */
-    int nin=2;
+    const int nin=2;
     std::vector<int> nout {6, 3, 2};
     
     // Now, initialize a maulti-layer perceptron, a very simple neural network.
@@ -43,76 +48,85 @@ int main(){
      * Let's create a training dataset, for training the MLP.
      * Each training example, will be a set of input, target.
      * input and target both will be a 2 dim vector.
+     * They are kept as plain floats, and only wrapped into Value objects inside the training step,
+     * because every non-parameter Value is released when the step's graph is reset.
     */
     int num_train = 10;
-    std::vector<std::tuple<std::vector<std::shared_ptr<Value>>, std::vector<std::shared_ptr<Value>>>> train_set;
+    std::vector<float> train_inputs;   // [num_train, 2], one example per row
+    std::vector<float> train_targets;  // [num_train, 2]
     for (int i=0; i < num_train; ++i){
-        std::vector<std::shared_ptr<Value>> operands;
-        std::vector<std::shared_ptr<Value>> label;
         float op1 = rand()%2;
         float op2 = rand()%2;
-        auto operand_1 = std::make_shared<Value>(op1);
-        auto operand_2 = std::make_shared<Value>(op2);
-        operands.push_back(operand_1);
-        operands.push_back(operand_2);
+        train_inputs.push_back(op1);
+        train_inputs.push_back(op2);
 
         if (op1 && op2){
-            auto prob_0 = std::make_shared<Value>(0.0);
-            auto prob_1 = std::make_shared<Value>(1.0);
-            label.push_back(prob_0);
-            label.push_back(prob_1);
+            train_targets.push_back(0.0);
+            train_targets.push_back(1.0);
         }
         else{
-            auto prob_0 = std::make_shared<Value>(1.0);
-            auto prob_1 = std::make_shared<Value>(0.0);
-            label.push_back(prob_0);
-            label.push_back(prob_1);
+            train_targets.push_back(1.0);
+            train_targets.push_back(0.0);
         }
-        std::tuple<std::vector<std::shared_ptr<Value>>, std::vector<std::shared_ptr<Value>>> train_example(operands, label);
-        train_set.push_back(train_example);
     } 
 
     /**
      * @brief Training Loop
-     * do one loop for the entire training set.
-     * feed each input to mlp, get the output from mlp which will be a 2 dim vector.
-     * the target is also a 2 dim vector.
-     * calculate the loss, (prediction[i]-target[i])^2 where i is 0, and 1.
+     * do one loop for the entire training set, in a random order, a minibatch of `batch_size` examples at a time.
+     * feed the whole minibatch to mlp as one [batch_size, 2] matrix, get back a [batch_size, 2] tensor of predictions.
+     * each row of it is the prediction for one example, and the target is also a 2 dim vector.
+     * calculate the loss of each example, (prediction[i]-target[i])^2 where i is 0, and 1.
      * Mean squared error is a simple loss function we can take.
-     * then do loss->backward(). As loss is the final value object created in the entire computation graph.
+     * the loss of the minibatch is the mean of the losses of its examples.
+     * then do loss.backward(). As loss is the final value object created in the entire computation graph.
      * This will calulate gradient for all weights in the mlp, hence an `autograd engine`.
-     * Then update all weights by doing w_new = w-lr*grad.
+     * Since the loss is a mean, the gradient is the mean gradient over the minibatch.
+     * Then update all weights by doing w_new = w-lr*grad, once per minibatch.
      * The gradient will guide the weights such that the overall loss reduces.
      * And as we see the loss gradually decreases!
     */
     std::cout<<"\nTraining loop:"<<std::endl;
-    std::shared_ptr<Value> final_loss;
     float learning_rate = 0.1;
-    int i=0;
-    for (auto& train_example: train_set){
-        auto operands = std::get<0>(train_example);
-        auto target = std::get<1>(train_example);
+    int batch_size = 2;
 
-        auto prediction = mlp(operands);
-        std::shared_ptr<Value> total_loss = std::make_shared<Value>(0.0);
-        for (int i=0; i<target.size(); ++i){
-            auto loss = prediction[i]-target[i];
-            loss->pow(std::make_shared<Value>(2));
-            total_loss = total_loss+loss;
-        }
-        final_loss = total_loss / std::make_shared<Value>(target.size());
+    /**
+     * @brief Data-parallel training
+     * The minibatch is split across threads, each of them runs the loss below on its share of the rows,
+     * in a graph of its own. Their gradients are then summed up into the parameters' grads.
+     * Here each thread gets one example of the minibatch, with bigger minibatches use as many threads as there are cores.
+    */
+    auto mse = [](MLP& mlp, const float* x, const float* y, uint32_t batch) {
+        Tensor prediction = mlp(Tensor::input(x, batch, nin));
+        // mean over the examples of mean((prediction[i]-target[i])^2), as one node instead of a few per element.
+        return mse_loss(prediction, y);
+    };
+    DataParallel trainer(mlp, mse, batch_size);
+    // w_new = w-lr*grad for all weights at once, in one pass over the flat parameter and grad buffers.
+    SGD optimizer(mlp.parameters(), learning_rate);
 
-        mlp.zero_grad();
-        final_loss->backward();
-        
-        for (auto param : mlp.parameters()) {
-            auto updated_weight = param->get_data()-learning_rate * param->get_grad();
-            param->set_data(updated_weight);
-        }
-        std::cout<<"Iteration "<<i<<" Loss: "<<final_loss->get_data()<<std::endl;
+    /**
+     * @brief Input pipeline
+     * A background thread shuffles the training set and gathers the next minibatches while the current one trains,
+     * so the loop below never waits for its data.
+    */
+    BatchLoader loader(train_inputs.data(), train_targets.data(), num_train, nin, 2, batch_size);
+
+    int i=0;
+    while (const Batch* batch = loader.next()){
+        optimizer.zero_grad();
+        float final_loss = trainer.step(batch->x, nin, batch->y, 2, batch->rows);
+        optimizer.step();
+        std::cout<<"Iteration "<<i<<" Loss: "<<final_loss<<std::endl;
         i+=1;
     }
 
+#ifdef MICROGRAD_PROFILE
+    // Where the training time went, see profile.h.
+    std::cout<<"\nProfile:\n";
+    profile_report(std::cout);
+    profile_write_trace("trace.json");
+#endif
+
     /**
      * @brief Checkout updated weights
      * If the weights updated correctly all the weights will be different from when they were initialized.
@@ -123,24 +137,22 @@ int main(){
 
     /**
      * @brief Test loop
-     * Same as the training loop.
+     * Same as the training loop, except nothing needs a gradient here,
+     * so mlp.predict() runs the network on plain floats without building a graph.
      * Just that we want to note which of the dimension in prediction vector scores the largest.
      * the dimension that scores the largest is the model's output of the input operands.
      * The more accurate the prediction, the more the model learns the AND gate logic.
     */
     std::cout<<"Now testing...\n\n";
     int num_test = 10;
-    std::vector<std::tuple<std::vector<std::shared_ptr<Value>>, std::vector<std::shared_ptr<Value>>>> test_set;
     int num_correct_preds=0;
     for (int i=0; i < num_test; ++i){
-        std::vector<std::shared_ptr<Value>> operands;
+        std::vector<float> operands;
         float label;
         float op1 = rand()%2;
         float op2 = rand()%2;
-        auto operand_1 = std::make_shared<Value>(op1);
-        auto operand_2 = std::make_shared<Value>(op2);
-        operands.push_back(operand_1);
-        operands.push_back(operand_2);
+        operands.push_back(op1);
+        operands.push_back(op2);
 
         if (op1 && op2){
             label = 1;
@@ -148,9 +160,9 @@ int main(){
         else{
             label = 0;
         }
-        auto prediction = mlp(operands);
+        auto prediction = mlp.predict(operands);
         float predicted_value;
-        // std::cout<<prediction[0]->get_data()<<prediction[1]->get_data()<<std::endl;
+        // std::cout<<prediction[0]<<prediction[1]<<std::endl;
         if (prediction[0]>prediction[1]){
             predicted_value=0;
         }